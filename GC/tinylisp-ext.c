@@ -0,0 +1,40 @@
+/* tinylisp-ext.c example extension with primitives written in C for tinylisp-extras-expand-gc loaded at runtime with
+   (load-extension "./tinylisp-ext.so")
+
+   compile the interpreter to export the C API to extensions:
+   cc -O2 -fvisibility=hidden -rdynamic -o tinylisp tinylisp-extras-expand-gc.c -lreadline -lm -lpthread -ldl
+   compile the extension:
+   cc -O2 -fPIC -shared -o tinylisp-ext.so tinylisp-ext.c */
+
+#include <string.h>
+#include "tinylisp.h"
+
+/* (fib n) returns the n'th Fibonacci number */
+double f_fib(double t,double *e) {
+ uint32_t a = 0; double n = gclisp(arglisp(&t,e,&a)),x = 0,y = 1,z;
+ if (typelisp(n)) return errlisp(9,n);
+ for (; n > 0; --n) z = x+y,x = y,y = z;
+ return x;
+}
+
+/* (string-reverse s) returns a new string with the chars of string or atom s reversed */
+double f_stringreverse(double t,double *e) {
+ uint32_t a = 0; double x = arglisp(&t,e,&a),y; const char *s = textlisp(NULL,x); size_t i,k; char b[256];
+ if (!s || (k = strlen(s)) >= sizeof(b)) return errlisp(9,gclisp(x));
+ for (i = 0; i < k; ++i) b[i] = s[k-i-1];
+ y = stringlisp(b,k);
+ gclisp(x);
+ return y;
+}
+
+/* (unless x y) returns y evaluated when x is (), tail-call flag is set so y is returned to evaluate */
+double f_unless(double t,double *e) {
+ uint32_t a = 0; double x = gclisp(arglisp(&t,e,&a));
+ return typelisp(x) == 6 ? carlisp(NULL,t) : nillisp();
+}
+
+/* add the primitives of the extension to instance c, returns zero when successful */
+int initlisp(struct lisp *c) {
+ return primlisp(c,"fib",f_fib,0) < 0 || primlisp(c,"string-reverse",f_stringreverse,0) < 0 ||
+     primlisp(c,"unless",f_unless,1) < 0;
+}
@@ -5,6 +5,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <math.h> /* to return NAN from num() */
+#include <signal.h> /* signal() is used by ms() before section 14 */
 
 #ifndef TEST
 # ifdef DEBUG
@@ -46,41 +47,184 @@
 #define A (char*)cell
 
 /* number of cells for the shared pool and atom heap, increase N as desired */
+#ifndef N
 #define N 8192
+#endif
 
 /* section 12: adding readline with history ++ new: support nested load, new err 5 can't open file */
 #include <readline/readline.h>
 #include <readline/history.h>
-FILE *in[10],*out;
-char buf[256],see = 0,*ptr = "",*line = NULL,ps[80];
+#include <setjmp.h>
+
+/* ++ new: system headers of the extensions, included before the macros below that name the members of struct lisp */
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#ifdef TIME
+#include <sys/time.h>
+#endif
+#ifndef LIB
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#endif
+/* ++ new: SIMD kernel width of the SIMD numeric vector primitives, 4 (AVX), 2 (SSE2) or 1 (scalar) */
+#ifndef SIMD
+#define SIMD 4
+#endif
+#if SIMD > 1 && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
 
 /* prompt strings for readline (truncates to 80 chars max), use \001 to ignore codes up to \002 */
 /* NOTE: MacOS Darwin uses libedit as a libreadline "compatible", but that does not display prompt colors! */
 #define PS1 "\001\e[32;1m\002%u>\001\e[m\002"
 #define PS2 "\001\e[32;1m\002? \001\e[m\002"
 
+/* ++ new: API marks the functions of the C API declared in tinylisp.h, the only functions exported by a library that is
+   compiled with -fvisibility=hidden */
+#ifdef __GNUC__
+#define API __attribute__((visibility("default")))
+#else
+#define API
+#endif
+
 /* forward proto declarations */
-L eval(L,L),expand(L,L,L),cede(L),Read(),parse(),err(I,L); void collect(L),ms(L),print(FILE*,L),stop(int); I atomize(L,char*);
-
-/* section 4: constructing Lisp expressions (using a cell pool managed with reference count garbage collection) */
-/* hp: top of the atom heap pointer, A+hp with hp=0 points to the first atom string in cell[]
-   fp: free cell pairs list pointer, ref[fp/2] is the head of the linked list of free cell pairs
-   lp: pointer to the lowest allocated and used cell pair in cell[]
-   fn: number of free cell cons pairs, not taking space used by atoms into account (for reporting only, not required)
-   tr: tracing off (0), on (1), wait on ENTER (2), dump and wait (3)
-   ld: number of open loads from input files (nested load up to 10 levels deep)
-   safety invariant: hp+16 < lp<<3 */
-I hp = 0,fp = N-2,lp = N-2,fn = N/2,tr = 0,ld = 0;
-/* ref[] array with ref count of a used cell pair or ref to next free cell pair in the free list */
-I ref[N/2];
-/* atom, primitive, cons, closure and nil tags for NaN boxing */
-enum { ATOM = 0x7ff8,PRIM = 0x7ff9,CONS = 0x7ffa,CLOS = 0x7ffb,MACR = 0x7ffc,NIL = 0x7ffd,HOLD = 0x7ffe };
-/* cell[N] pool of allocatable Lisp expressions shared by the atom heap */
-L cell[N];
-/* Lisp global environment env */
-L env;
-/* section 17.1: early binding and efficient macro expansion */
-L p_quote,p_lambda,p_macro,p_cond,p_leta,p_let,p_letreca,p_letrec,p_define;
+L eval(L,L),expand(L,L,L),cede(L),Read(),parse(),err(I,L); void collect(L),ms(L),print(FILE*,L),stop(int),fail(L); I atomize(L,char*),fmt(char*,L);
+char scan(); void vgc(L),vmk(L),vcount(L),vfree(I),fdrop(I); I vnew(I),hash(L,I),int64(L,int64_t*); L apply(L,I,L*,L);
+
+/* atom, primitive, cons, closure and nil tags for NaN boxing ++ new: vector, hash table, string, bignum, future and event
+   tags VECT, HASH, STR, BIG, FUT and EVT with sign bit set, tags VECT and higher are blocks in the vec[] arena, RAW marks
+   raw bytes */
+enum { ATOM = 0x7ff8,PRIM = 0x7ff9,CONS = 0x7ffa,CLOS = 0x7ffb,MACR = 0x7ffc,NIL = 0x7ffd,HOLD = 0x7ffe,VECT = 0xfff9,
+    HASH = 0xfffa,STR = 0xfffb,BIG = 0xfffc,FUT = 0xfffd,EVT = 0xfffe,RAW = 0xffff };
+/* ++ new: vector arena size V, increase V as desired */
+#ifndef V
+#define V 65536
+#endif
+/* ++ new: mark-sweep garbage collector registry stack size S, max depth of nested calls to eval() = S/3 */
+#define S 4096
+
+/* ++ new: an active (call/ec f) frame with its escape continuation number n, the value x passed to the continuation, the
+   registry stack pointer q when the frame was entered and the enclosing frame up */
+struct esc { L n,x,**q; struct esc *up; };
+
+/* ++ new: all state of an interpreter instance is kept in a struct lisp, the thread-local cx points to the instance
+   used by the current thread, the macros below name the members of *cx to keep the code unchanged, newlisp() creates
+   and initializes an instance, uselisp() switches the current thread to an instance to run it */
+struct lisp {
+ /* section 12: nested load input files in[], output file out, readline line and input buffer with lookahead see,
+    batch: ++ new: input mode readline (0), read stdin without readline (1), read string ptr (2),
+    read string ptr for the C API without error messages (3) */
+ FILE *in[10],*out;
+ char buf[256],see,*ptr,*line,ps[80],batch;
+ /* section 4: constructing Lisp expressions (using a cell pool managed with reference count garbage collection)
+    hp: top of the atom heap pointer, A+hp with hp=0 points to the first atom string in cell[]
+    fp: free cell pairs list pointer, ref[fp/2] is the head of the linked list of free cell pairs
+    lp: pointer to the lowest allocated and used cell pair in cell[]
+    fn: number of free cell cons pairs, not taking space used by atoms into account (for reporting only, not required)
+    tr: tracing off (0), on (1), wait on ENTER (2), dump and wait (3)
+    ld: number of open loads from input files (nested load up to 10 levels deep)
+    dt: ++ new: number of destructive updates and redefinitions that may leave cyclic garbage, reset by rebuild()
+    dn: ++ new: number of definitions, to detect changes of the global environment
+    fz: ++ new: cell pairs from fz to N and atoms below fh are frozen, i.e. read-only, fz = N when none are frozen
+    fg: ++ new: the generation of the frozen template this instance is a clone of, zero when not a clone
+    mm: ++ new: nonzero when this instance is a copy-on-write mapping of the frozen template
+    ef: ++ new: the epoll file descriptor plus one of the event loop, zero when not yet created
+    safety invariant: hp+16 < lp<<3 */
+ I hp,fp,lp,fn,tr,ld,dt,dn,fz,fh,fg,mm,ef;
+ /* ref[] array with ref count of a used cell pair or ref to next free cell pair in the free list */
+ I ref[N/2];
+ /* ++ new: cached structural hashes hc[] of cell pairs, the hash of a pair is valid when its he[] equals the epoch ep */
+ I hc[N/2],he[N/2],ep;
+ /* cell[N] pool of allocatable Lisp expressions shared by the atom heap */
+ L cell[N];
+ /* ++ new: vec[V] arena of vector blocks below vp, a block of k elements vec[i+1] to vec[i+k] is preceded by its
+    header vec[i] holding the size VK(i) = k and the ref count VR(i), the ref count of a free block is FREE,
+    ++ new: blocks below fv are frozen */
+ union block { L x; I h[2]; } vec[V];
+ I vp,fv;
+ /* Lisp global environment env, ++ new: the list hv of values held by the C API and the list ev of pending events */
+ L env,hv,ev;
+ /* section 17.1: early binding and efficient macro expansion */
+ L p_quote,p_lambda,p_macro,p_cond,p_leta,p_let,p_letreca,p_letrec,p_define;
+ /* mark-sweep garbage collector roots stack, stack pointer, and catch exception pointer */
+ L *stk[S],**sp,**xp;
+ /* section 10: jump buffer of the current error handler, ++ updated: points to the jump buffer of the handler, so the
+    handlers do not copy jump buffers */
+ jmp_buf *jb;
+ /* ++ new: innermost active (call/ec f) frame es, target frame et of the escape in progress, number of frames en */
+ struct esc *es,*et; I en;
+ /* ++ new: an error that is not caught in the running future task marshals its value to eb, ex is the xp of the task,
+    in a pmap thread eb is NULL and the error value is kept in ey */
+ struct bytes *eb; L **ex,ey;
+ /* section 10: output buffer ob[] holds on chars to write to file of */
+ char ob[4096]; I on; FILE *of;
+};
+_Thread_local struct lisp *cx;
+#define in (cx->in)
+#define out (cx->out)
+#define buf (cx->buf)
+#define see (cx->see)
+#define ptr (cx->ptr)
+#define line (cx->line)
+#define ps (cx->ps)
+#define batch (cx->batch)
+#define hp (cx->hp)
+#define fp (cx->fp)
+#define lp (cx->lp)
+#define fn (cx->fn)
+#define tr (cx->tr)
+#define ld (cx->ld)
+#define dt (cx->dt)
+#define dn (cx->dn)
+#define fz (cx->fz)
+#define fh (cx->fh)
+#define fg (cx->fg)
+#define mm (cx->mm)
+#define ef (cx->ef)
+#define ref (cx->ref)
+#define hc (cx->hc)
+#define he (cx->he)
+#define ep (cx->ep)
+#define cell (cx->cell)
+#define vec (cx->vec)
+#define vp (cx->vp)
+#define fv (cx->fv)
+#define env (cx->env)
+#define hv (cx->hv)
+#define ev (cx->ev)
+#define p_quote (cx->p_quote)
+#define p_lambda (cx->p_lambda)
+#define p_macro (cx->p_macro)
+#define p_cond (cx->p_cond)
+#define p_leta (cx->p_leta)
+#define p_let (cx->p_let)
+#define p_letreca (cx->p_letreca)
+#define p_letrec (cx->p_letrec)
+#define p_define (cx->p_define)
+#define stk (cx->stk)
+#define sp (cx->sp)
+#define xp (cx->xp)
+#define jb (cx->jb)
+#define es (cx->es)
+#define et (cx->et)
+#define en (cx->en)
+#define eb (cx->eb)
+#define ex (cx->ex)
+#define ey (cx->ey)
+#define ob (cx->ob)
+#define on (cx->on)
+#define of (cx->of)
+#define VK(i) vec[i].h[0]
+#define VR(i) vec[i].h[1]
+
 /* NaN-boxing specific functions:
    T(x):     returns the tag bits of a NaN-boxed double x
    box(t,i): returns a new NaN-boxed double with tag t and ordinal i
@@ -92,6 +236,10 @@ L box(I t,I i) { union { uint64_t i; L x; } u = {(uint64_t)t<<48|i}; return u.x;
 I ord(L x) { union { L x; uint64_t i; } u = {x}; return u.i; }
 L num(L n) { return n == n ? n : NAN; }
 I equ(L x,L y) { union { L x; uint64_t i; } u = {x},v = {y}; return u.i == v.i; }
+/* ++ new: raw(i) is nonzero if the block vec[i] holds raw bytes after its first element vec[i+1] = box(RAW,length) */
+I raw(I i) { return VK(i) && T(vec[i+1].x) == RAW; }
+/* ++ new: a future block vec[i] holds the pointer to its task after vec[i+1] = FUTURE, the task is released by vfree(i) */
+#define FUTURE box(RAW,~(I)0)
 /* Lisp constant expressions () (nil is false), ERR (same as NAN), and #t (true) */
 #define nil box(NIL,0)          /* fixed constant, instead of nil = box(NIL,0) in main() */
 #define ERR box(ATOM,0)         /* fixed constant, instead of ERR = atom("ERR") in main() */
@@ -102,10 +250,6 @@ L atom(const char *s) {
  return i == hp && ((hp += strlen(s)+1)+16 > lp<<3 || !memmove(A+i,s,hp-i)) ? err(4,nil) : box(ATOM,i);
 }
 
-/* ++ new: mark-sweep garbage collector registry stack size S, max depth of nested calls to eval() = S/3 */
-#define S 4096
-/* mark-sweep garbage collector roots stack, stack pointer, and catch exception pointer */
-L *stk[S],**sp = stk,**xp = stk;
 /* memory management with ref[] array using free and SCC marker bits */
 const I FREE = ~((I)~0UL>>1),MARK = FREE,SCC = MARK>>1;
 /* lowest pointer to allocated cells in memory */
@@ -113,7 +257,7 @@ I lomem(I i) { return lp = i < lp ? i : lp; }
 /* allocate and construct a new pair (x . y), returns a NaN-boxed CONS */
 L cons(L x,L y) {
  I i = fp; L p = box(CONS,i);
- fp = ref[i/2]&~FREE; ref[i/2] = 1; --fn; cell[i+1] = x; cell[i] = y; LOG(p,"\n\e[32mcons %u\e[m\t",i);
+ fp = ref[i/2]&~FREE; ref[i/2] = 1; he[i/2] = 0; --fn; cell[i+1] = x; cell[i] = y; LOG(p,"\n\e[32mcons %u\e[m\t",i);
  if (TEST || hp+16 > fp<<3) ms(p); else lomem(i);
  return p;
 }
@@ -122,10 +266,12 @@ void del(I i) { ref[i/2] = FREE|fp; fp = i; ++fn; }
 /* from cell pair x onwards, delete entire SCC identified by representative k with SCC bit set, gc non-SCC branches */
 void delscc(I k,L x) {
  I i; L y;
- while (!(ref[(i = ord(x))/2]&FREE)) {                  /* repeat until all SCC cell pairs x are deleted */
+ while ((i = ord(x)) < fz && !(ref[i/2]&FREE)) {       /* repeat until all SCC cell pairs x are deleted */
   LOG(x,"\n\e[36mfree %u\e[m\t",i);
   del(i);                                               /* delete the SCC cell pair x to reuse */
   x = cell[i]; y = cell[i+1];                           /* recurse on y = car(x) and x = cdr(x) */
+  if (T(y) >= VECT) vgc(y);                             /* ++ new: collect vectors and hash tables */
+  if (T(x) >= VECT) vgc(x);
   if (T(y) == CONS || T(y) == CLOS) {
    if (T(x) == CONS || T(x) == CLOS) {
     if (ref[ord(y)/2] != k) collect(y);                 /* only cdr(x) is part of the SCC, car(x) is a pair */
@@ -140,7 +286,8 @@ void delscc(I k,L x) {
 void collect(L x) {
  I i; L y;
  while (1) {
-  if (ref[(i = ord(x))/2]&FREE) {                       /* detect double free, which should never happen */
+  if ((i = ord(x)) >= fz) return;                       /* ++ new: frozen cell pairs are not ref counted */
+  if (ref[i/2]&FREE) {                                  /* detect double free, which should never happen */
    printf("\n\e[31;1mdouble free %u\e[m\t",i);
    err(4,nil);
   }
@@ -153,6 +300,8 @@ void collect(L x) {
   LOG(x,"\n\e[35mfree %u\e[m\t",i);
   del(i);                                               /* then delete the cell pair to reuse */
   x = cell[i]; y = cell[i+1];                           /* recurse on y = car(x) and x = cdr(x) */
+  if (T(y) >= VECT) vgc(y);                             /* ++ new: collect vectors and hash tables */
+  if (T(x) >= VECT) vgc(x);
   if (T(y) == CONS || T(y) == CLOS || T(y) == MACR) {
    if (T(x) == CONS || T(x) == CLOS || T(x) == MACR) collect(y);
    else x = y;
@@ -162,7 +311,7 @@ void collect(L x) {
  LOG(x,"\n\e[35m--#%u=%u\e[m\t",i,ref[i/2]);
 }
 /* garbage collect: if x is a pair then collect pair x by decrementing its ref count, deleting it if count drops to 0 */
-L gc(L x) { if (T(x) == CONS || T(x) == CLOS || T(x) == MACR) collect(x); return x; }
+L gc(L x) { if (T(x) == CONS || T(x) == CLOS || T(x) == MACR) collect(x); else if (T(x) >= VECT) vgc(x); return x; }
 /* register x as a root on the stack with initial value y to collect with rg() or deregister with rr() */
 L rc(L *x,L y) { *x = y; *sp = x,++sp; return y; }      /* GCC incorrectly warns about *sp++ = x dangling pointer */
 /* remove k registrations from the stack and garbage collect them */
@@ -170,21 +319,29 @@ void rg(I k) { while (k--) gc(**--sp); }
 /* remove k registrations from the stack without garbage collecting them */
 void rr(I k) { sp -= k; }
 /* duplicate expression x: if x is a pair then increment its ref count by one */
-L dup(L x) {
+L dupl(L x) {
  if (T(x) == CONS || T(x) == CLOS || T(x) == MACR) {
   I i = ord(x);
+  if (i >= fz) return x;                                /* ++ new: frozen cell pairs are not ref counted */
   if (ref[i/2]&SCC) i = ref[i/2]&~SCC;                  /* if x is in an SCC then update SCC representative ref count */
   ++ref[i/2];                                           /* increment ref count */
   LOG(x,"\n\e[32m++#%u=%u\e[m\t",i,ref[i/2]);
  }
+ else if (T(x) >= VECT && ord(x) >= fv) ++VR(ord(x));  /* ++ new: increment vector/hash ref count */
  return x;
 }
+/* ++ new: returns pair or block x when not frozen, ERR 11 when frozen, i.e. read-only */
+L mut(L x) {
+ return (T(x) >= VECT ? ord(x) < fv : (T(x) == CONS || T(x) == CLOS || T(x) == MACR) && ord(x) >= fz) ? err(11,x) : x;
+}
 /* ++ new: mark-sweep collector marking stage: recursively mark all cell pairs reachable from cell pair x */
 void mk(L x) {
  I i; L y;
- while (!(ref[(i = ord(x))/2]&MARK)) {                  /* repeat until all reachable cell pairs are marked */
+ while ((i = ord(x)) < fz && !(ref[i/2]&MARK)) {       /* repeat until all reachable cell pairs are marked */
   ref[i/2] |= MARK;                                     /* mark cell pair x */
   x = cell[i]; y = cell[i+1];                           /* recurse on y = car(x) and x = cdr(x) */
+  if (T(y) >= VECT) vmk(y);                             /* ++ new: mark vectors and hash tables */
+  if (T(x) >= VECT) vmk(x);
   if (T(y) != CONS && T(y) != CLOS && T(y) != MACR) {
    if (T(x) != CONS && T(x) != CLOS && T(x) != MACR) break;
   }
@@ -202,14 +359,18 @@ void ms(L p) {
  I k = fn;
 #endif
  signal(SIGINT,SIG_IGN);                                /* disable SIGINT CTRL-C: don't interrupt mark-sweep */
- for (i = 0; i < N/2; ++i) ref[i] &= ~FREE;             /* remove FREE/MARK markers from all cell refs */
+ for (i = 0; i < fz/2; ++i) ref[i] &= ~FREE;            /* remove FREE/MARK markers from all cell refs */
  mk(p);                                                 /* mark root p as used */
  if (T(env) == CONS) mk(env);                           /* mark root env, recursively marks env cells as used */
+ if (T(hv) == CONS) mk(hv);                             /* ++ new: mark the values held by the C API as used */
+ if (T(ev) == CONS) mk(ev);                             /* ++ new: mark the pending events as used */
  for (q = stk; q < sp; ++q)                             /* mark stack roots, marks registered cells as used */
-  if (T(**q) == CONS || T(**q) == CLOS || T(**q) == MACR) mk(**q);
- for (fp = 0,lp = N-2,fn = 1,i = 2; i < N; i += 2)      /* add unused cells to the free list */
+  if (T(**q) == CONS || T(**q) == CLOS || T(**q) == MACR) mk(**q); else if (T(**q) >= VECT) vmk(**q);
+ for (fp = 0,lp = fz-2,fn = 1,i = 2; i < fz; i += 2)    /* add unused cells to the free list */
   if (ref[i/2]&MARK) lomem(i); else del(i);
- for (i = 0; i < N/2; ++i) ref[i] &= ~MARK;             /* clean up FREE/MARK markers from all cell refs */
+ for (i = fv; i < vp; i += VK(i)+1)                     /* ++ new: free unmarked vectors, remove SCC marks */
+  if (VR(i)&SCC) VR(i) &= ~SCC; else vfree(i);
+ for (i = 0; i < fz/2; ++i) ref[i] &= ~MARK;            /* clean up FREE/MARK markers from all cell refs */
  for (i = fp; i; i = (ref[i/2]&~FREE)) ref[i/2] |= FREE;/* set all free list cell refs to FREE */
  signal(SIGINT,stop);                                   /* re-enable SIGINT CTRL-C */
 #if DEBUG                                               /* report on memory management when debugging is enabled */
@@ -234,21 +395,28 @@ void ms(L p) {
    ERR 5: cannot open file
    ERR 6: program stopped
    ERR 7: syntax error
-   ERR 8: too few arguments */
-#include <setjmp.h>
-#include <signal.h>
-jmp_buf jb;
-/* report an error message when tracing or if error 1<=i<=8 without a catch handler */
+   ERR 8: too few arguments
+   ERR 9: ++ new: wrong type of argument
+   ERR 10: ++ new: index out of range
+   ERR 11: ++ new: read only, frozen data cannot be updated
+   ERR 12: ++ new: not an error, an escape to a (call/ec f) in progress, which is not reported and not caught */
+/* ++ new: console output of messages, string mode writes messages to the output */
+FILE *con() { return batch >= 2 ? out : stdout; }
+/* report an error message when tracing or if error 1<=i<=11 without a catch handler */
 void msg(I i,L x) {
- if (xp != stk ? tr : i >= 1 && i <= 8) {
-  const char *s[8] = {"not a pair","unbound","cannot apply","out of memory","cannot open","stopped","syntax","few arg"};
-  printf("\n\e[31;1mERR %u: ",i); print(stdout,x); printf(" %s\e[m\n",i >= 1 && i <= 8 ? s[i-1] : "");
+ if (batch < 3 && (xp != stk ? tr : i >= 1 && i <= 11)) {
+  const char *s[11] = {"not a pair","unbound","cannot apply","out of memory","cannot open","stopped","syntax","few arg",
+      "wrong type","out of range","read only"};
+  fprintf(con(),"\n\e[31;1mERR %u: ",i); print(con(),x); fprintf(con()," %s\e[m\n",i >= 1 && i <= 11 ? s[i-1] : "");
  }
 }
-/* throw an error */
-L err(I i,L x) { msg(i,x); longjmp(jb,i); }
+/* throw an error, deregister and garbage collect "lost" variables while their stack frames are still valid */
+L err(I i,L x) { msg(i,x); if (xp == ex) fail(x); rg(sp-xp); longjmp(*jb,i); }
+/* ++ new: re-throw error i to the next handler, an escape in progress deregisters and garbage collects the variables up
+   to the next catch or the target (call/ec f) frame, whichever is nearer */
+L rethrow(I i) { if (et) rg(sp-(xp > et->q ? xp : et->q)); longjmp(*jb,i); }
 /* SIGINT CTRL-C break running programs */
-void stop(int i) { if (line) err(6,nil); else abort(); }
+void stop(int i) { if (cx && line) err(6,nil); else abort(); }
 
 /* unsafe fast car and cdr, must be guarded to use: if (T(x) == CONS) { ... CAR(x) ... CDR(x) ... } */
 #define CAR(p) cell[ord(p)+1]
@@ -275,12 +443,19 @@ I not(L x) { return T(x) == NIL; }
 I let(L x) { return T(x) == CONS && T(CDR(x)) == CONS; }
 /* ++ new: opt(t) returns the first list item or (), i.e. the list t and the first item are optional */
 L opt(L t) { return let(t) ? CAR(CDR(t)) : nil; }
+/* ++ new: invalidate all cached hashes by advancing the epoch */
+void stale() { if (!++ep) memset(he,0,sizeof(he)),ep = 1; }
+/* ++ new: invalidate all cached hashes when pair p is updated and the hash of p is cached, otherwise the hashes of all pairs
+   that contain p are not cached either, because the hash of a pair is cached after the hashes of the pairs it contains */
+void dirty(L p) { if (he[ord(p)/2] == ep) stale(); }
 
 /* rebuild ref count by incrementing the ref count of all cells reachable from cell pair x */
 void count(L x) {
  I i; L y;
- while (!ref[(i = ord(x))/2]++) {                       /* increment ref count, but recurse at most once on x */
+ while ((i = ord(x)) < fz && !ref[i/2]++) {            /* increment ref count, but recurse at most once on x */
   x = cell[i]; y = cell[i+1];                           /* recurse on y = car(x) and x = cdr(x) */
+  if (T(y) >= VECT) vcount(y);                          /* ++ new: count vectors and hash tables */
+  if (T(x) >= VECT) vcount(x);
   if (T(y) != CONS && T(y) != CLOS && T(y) != MACR) {
    if (T(x) != CONS && T(x) != CLOS && T(x) != MACR) break;
   }
@@ -290,19 +465,27 @@ void count(L x) {
 }
 /* sweep unused cells after count() into the free cell pair list, shrink the atom heap when possible */
 void sweep() {
- I i; for (hp = 0,i = 0; i < N; ++i) if (ref[i/2] && T(cell[i]) == ATOM && ord(cell[i]) > hp) hp = ord(cell[i]);
+ I i,j; for (hp = 0,i = 0; i < fz; ++i) if (ref[i/2] && T(cell[i]) == ATOM && ord(cell[i]) > hp) hp = ord(cell[i]);
+ for (i = fv; i < vp; i += VK(i)+1)                     /* ++ new: free unused vectors, keep atoms used by vectors */
+  if (!VR(i)) vfree(i);
+  else if (VR(i) != FREE && !raw(i))
+   for (j = i+1; j <= i+VK(i); ++j) if (T(vec[j].x) == ATOM && ord(vec[j].x) > hp) hp = ord(vec[j].x);
  if (hp) hp += strlen(A+hp)+1;
- for (fp = 0,lp = N-2,fn = 1,i = 2; i < N; i += 2) if (ref[i/2]) lomem(i); else del(i);
+ if (hp < fh) hp = fh;                                  /* ++ new: keep the frozen atoms */
+ for (fp = 0,lp = fz-2,fn = 1,i = 2; i < fz; i += 2) if (ref[i/2]) lomem(i); else del(i);
 }
 /* rebuild memory to retain the global environment env and delete everything else */
 void rebuild() {
- I k = fn;
+ I i,k = fn;
 #if DEBUG
- I i,r[N/2];
+ I r[N/2];
  memcpy(r,ref,sizeof(ref));
 #endif
- memset(ref,0,sizeof(ref));
+ memset(ref,0,fz/2*sizeof(I));
+ for (i = fv; i < vp; i += VK(i)+1) if (VR(i) != FREE) VR(i) = 0;
  count(env);
+ if (T(hv) == CONS) count(hv);                          /* ++ new: retain the values held by the C API */
+ if (T(ev) == CONS) count(ev);                          /* ++ new: retain the pending events */
  sweep();
 #if DEBUG                                               /* report on memory management when debugging is enabled */
  for (i = 0; i < N/2; ++i) {
@@ -314,14 +497,67 @@ void rebuild() {
    LOG(cell[2*i+1],"\n\e[31;1mref[%u] want %u have %u\e[m\t",2*i,ref[i],r[i]),LOG(cell[2*i],"\t");
  }
 #endif
- if (k < fn) printf("\ncollected %u unused cells",2*(fn-k));
+ if (k < fn && batch < 3) printf("\ncollected %u unused cells",2*(fn-k));
  xp = sp = stk;                                         /* clear stack pointers */
+ dt = 0;
+}
+
+/* ++ new: allocate a vector block of k elements, returns the index i of its header vec[i] with ref count 1 */
+I vnew(I k) {
+ I i,j,n = 0;
+ while (1) {
+  for (i = fv; i < vp; i += VK(i)+1) {                  /* first fit */
+   if (VR(i) != FREE) continue;
+   while ((j = i+VK(i)+1) < vp && VR(j) == FREE) VK(i) += VK(j)+1;      /* coalesce adjacent free blocks */
+   if (j == vp) { vp = i; break; }                      /* shrink the arena when the free block is the last block */
+   if (VK(i) >= k) {
+    if (VK(i) > k) VK(j = i+k+1) = VK(i)-k-1,VR(j) = FREE,VK(i) = k;   /* split off the remaining free block */
+    VR(i) = 1;
+    return i;
+   }
+  }
+  if (vp+k+1 <= V && vp+k+1 > vp) { i = vp; vp += k+1; VK(i) = k; VR(i) = 1; return i; }
+  if (n++) err(4,nil);
+  ms(env);                                              /* mark-sweep to free unreachable (cyclic) vectors, then retry */
+ }
+}
+/* ++ new: free block i, release the task of a future */
+void vfree(I i) { if (VR(i) != FREE && VK(i) > 1 && equ(vec[i+1].x,FUTURE)) fdrop(i); VR(i) = FREE; }
+/* ++ new: collect vector, hash table or string x: decrement ref count by one, if count drops to zero then free x and collect its elements */
+void vgc(L x) {
+ I i = ord(x),j;
+ if (i < fv) return;                                    /* ++ new: frozen blocks are not ref counted */
+ if (VR(i) == FREE) {                                   /* detect double free, which should never happen */
+  printf("\n\e[31;1mdouble free vector %u\e[m\t",i);
+  err(4,nil);
+ }
+ if (--VR(i)) return;
+ vfree(i);
+ if (!raw(i)) for (j = i+1; j <= i+VK(i); ++j) gc(vec[j].x);
+}
+/* ++ new: mark vector, hash table or string x and all cell pairs and vectors reachable from it with the SCC bit of its ref count */
+void vmk(L x) {
+ I i = ord(x),j;
+ if (i < fv || VR(i)&SCC) return;
+ VR(i) |= SCC;
+ if (raw(i)) return;
+ for (j = i+1; j <= i+VK(i); ++j)
+  if (T(x = vec[j].x) == CONS || T(x) == CLOS || T(x) == MACR) mk(x); else if (T(x) >= VECT) vmk(x);
+}
+/* ++ new: rebuild ref count by incrementing the ref count of vector, hash table or string x and all cells and vectors reachable from it */
+void vcount(L x) {
+ I i = ord(x),j;
+ if (i < fv || VR(i)++) return;
+ if (raw(i)) return;
+ for (j = i+1; j <= i+VK(i); ++j)
+  if (T(x = vec[j].x) == CONS || T(x) == CLOS || T(x) == MACR) count(x); else if (T(x) >= VECT) vcount(x);
 }
 
 /* detect SCC from origin cell[i] while visiting x, ignore paths to cell[k] */
 I cyclic(I i,L x,I k) {
  if (T(x) == CONS || T(x) == CLOS) {
   I j = ord(x);
+  if (j >= fz) return 0;                                /* ++ new: frozen cell pairs are not in an SCC */
   if (i != j && !(ref[j/2]&SCC)) {
    L y = cell[j+1],z = j == k ? nil : cell[j];          /* y = car(x) and z = cdr(x) if not cell[k] */
    ref[i/2] |= MARK;
@@ -353,7 +589,7 @@ void scc(L x,I k) {
 L evlis(L t,L e) {
  L s,*p = &s;
  for (rc(p,nil); T(t) == CONS; p = &CDR(*p),t = CDR(t)) *p = cons(eval(CAR(t),e),nil);
- if (T(t) == ATOM) *p = dup(assoc(t,e));
+ if (T(t) == ATOM) *p = dupl(assoc(t,e));
  rr(1);
  return s;
 }
@@ -364,38 +600,250 @@ L evarg(L *t,L *e,I *a) {
  if (T(*t) == ATOM && !*a) *t = assoc(*t,*e),*a = 1;
  if (T(*t) != CONS) err(8,nil);
  x = CAR(*t); *t = CDR(*t);
- return *a ? dup(x) : eval(x,*e);
+ return *a ? dupl(x) : eval(x,*e);
 }
 I isarg(L *t,L *e,I *a,L *x) {
  if (T(*t) == ATOM && !*a) *t = assoc(*t,*e),*a = 1;
  if (T(*t) != CONS) return 0;
  *x = CAR(*t); *t = CDR(*t);
- *x = *a ? dup(*x) : eval(*x,*e);
+ *x = *a ? dupl(*x) : eval(*x,*e);
  return 1;
 }
 
+/* ++ new: bignums are exact integers beyond 2^53 in magnitude, stored as raw blocks in the vec[] arena, the block vec[i]
+   of bignum box(BIG,i) holds vec[i+1] = box(RAW,2*n+s) with the number of limbs n and the sign s, followed by the n
+   limbs BD(i)[0] to BD(i)[n-1] of 32 bits from least to most significant, bignum results within 2^53 are doubles */
+#define BN(i) (ord(vec[(i)+1].x)>>1)
+#define BS(i) (ord(vec[(i)+1].x)&1)
+#define BD(i) ((I*)&vec[(i)+2])
+/* the sign s, the number of limbs n and the limbs d[0..n-1] of an exact integer operand, d = w for a double */
+struct big { I s,n,*d,w[2]; };
+/* exact(x) is nonzero if x is a bignum or a double with an integer value within 2^53 in magnitude */
+I exact(L x) { return T(x) == BIG || (x == floor(x) && fabs(x) <= 0x1p53); }
+/* flo(x) returns bignum x converted to a double, or number x */
+L flo(L x) {
+ I i = ord(x),k; L n = 0;
+ if (T(x) != BIG) return x;
+ for (k = BN(i); k-- > 0; ) n = n*0x1p32+BD(i)[k];
+ return BS(i) ? -n : n;
+}
+/* isnum(x) is nonzero if x is a number or a bignum */
+I isnum(L x) { return x == x || T(x) == BIG; }
+/* val(x) returns bignum or number x, or returns NAN after garbage collecting x when x is not a number */
+L val(L x) { return T(x) == BIG ? x : num(gc(x)); }
+/* dbl(x) returns bignum or number x as a double after garbage collecting x, or NAN when x is not a number */
+L dbl(L x) { L n = flo(x = val(x)); gc(x); return n; }
+/* set b to the sign and limbs of exact integer x */
+void limbs(L x,struct big *b) {
+ uint64_t u;
+ if (T(x) == BIG) { b->s = BS(ord(x)); b->n = BN(ord(x)); b->d = BD(ord(x)); return; }
+ u = fabs(x); b->s = x < 0; b->d = b->w; b->w[0] = u; b->w[1] = u>>32; b->n = u>>32 ? 2 : u ? 1 : 0;
+}
+/* allocate a bignum block with room for n limbs, returns its index i */
+I bnew(I n) { I i = vnew((n+1)/2+1); vec[i+1].x = box(RAW,2*n); return i; }
+/* normalize bignum block i with n limbs and sign s, returns the bignum or returns a double when within 2^53 */
+L bnorm(I i,I n,I s) {
+ I *d = BD(i); L x;
+ while (n && !d[n-1]) --n;
+ if (n > 2 || (n == 2 && d[1] >= 0x200000 && (d[1] > 0x200000 || d[0]))) return vec[i+1].x = box(RAW,2*n+s),box(BIG,i);
+ x = n == 2 ? d[1]*0x1p32+d[0] : n ? d[0] : 0;
+ vgc(box(BIG,i));
+ return s && n ? -x : x;
+}
+/* compare the magnitudes of a and b, returns <0, 0 or >0 */
+int ucmp(struct big *a,struct big *b) {
+ I k = a->n;
+ if (a->n != b->n) return a->n < b->n ? -1 : 1;
+ while (k-- > 0) if (a->d[k] != b->d[k]) return a->d[k] < b->d[k] ? -1 : 1;
+ return 0;
+}
+/* set r[] to |a|+|b| or to |a|-|b| when o is '-', where a has at least as many limbs as b and |a| >= |b| if o is '-',
+   returns the number of limbs of r[] */
+I uadd(I *r,struct big *a,struct big *b,char o) {
+ I k; int64_t c = 0;
+ for (k = 0; k < a->n; ++k,c >>= 32) r[k] = c += a->d[k]+(k < b->n ? o == '-' ? -(int64_t)b->d[k] : b->d[k] : 0);
+ r[k] = c;
+ return k+1;
+}
+/* set r[] to the a->n+b->n limbs of |a|*|b| */
+void umul(I *r,struct big *a,struct big *b) {
+ I j,k; uint64_t c;
+ memset(r,0,4*(a->n+b->n));
+ for (j = 0; j < a->n; ++j) {
+  for (c = 0,k = 0; k < b->n; ++k,c >>= 32) r[j+k] = c += (uint64_t)a->d[j]*b->d[k]+r[j+k];
+  r[j+b->n] = c;
+ }
+}
+/* set q[] to the u->n-v->n+1 limbs of |u|/|v| and r[] to the v->n limbs of |u|%|v| where u->n >= v->n > 0, using
+   Knuth's algorithm D with the divisor normalized to have its most significant bit set */
+void udiv(I *q,I *r,struct big *u,struct big *v) {
+ I m = u->n,n = v->n,un[m+1],vn[n],s,j,k; uint64_t p,qh,rh; int64_t c,t;
+ if (n == 1) {
+  for (p = 0,j = m; j-- > 0; p %= v->d[0]) p = p<<32|u->d[j],q[j] = p/v->d[0];
+  *r = p;
+  return;
+ }
+ s = __builtin_clz(v->d[n-1]);
+ for (k = n-1; k > 0; --k) vn[k] = v->d[k]<<s|(uint64_t)v->d[k-1]>>(32-s);
+ vn[0] = v->d[0]<<s;
+ un[m] = (uint64_t)u->d[m-1]>>(32-s);
+ for (k = m-1; k > 0; --k) un[k] = u->d[k]<<s|(uint64_t)u->d[k-1]>>(32-s);
+ un[0] = u->d[0]<<s;
+ for (j = m-n+1; j-- > 0; ) {
+  p = (uint64_t)un[j+n]<<32|un[j+n-1];                 /* estimate the quotient limb qh, at most 2 too large */
+  qh = p/vn[n-1]; rh = p%vn[n-1];
+  while (qh >> 32 || qh*vn[n-2] > (rh<<32|un[j+n-2])) if ((rh += vn[n-1],--qh,rh >> 32)) break;
+  for (c = 0,k = 0; k < n; ++k) {                       /* multiply and subtract */
+   p = qh*vn[k];
+   t = un[k+j]-c-(p&0xffffffff);
+   un[k+j] = t;
+   c = (p>>32)-(t>>32);
+  }
+  t = un[j+n]-c; un[j+n] = t;
+  q[j] = qh;
+  if (t < 0) {                                          /* add back when qh was one too large */
+   --q[j];
+   for (c = 0,k = 0; k < n; ++k,c >>= 32) un[k+j] = c += (uint64_t)un[k+j]+vn[k];
+   un[j+n] += c;
+  }
+ }
+ for (k = 0; k < n; ++k) r[k] = un[k]>>s|(uint64_t)un[k+1]<<(32-s);
+}
+/* exact integer arithmetic x o y with o one of + - * / % of exact integers x and y where y is nonzero when o is / or %,
+   returns a bignum, or a double when the result is within 2^53 or when the quotient x/y is not an integer */
+L big(L x,L y,char o) {
+ struct big a,b,*u = &a,*v = &b; I i,s;
+ limbs(x,&a); limbs(y,&b);
+ if (o == '+' || o == '-') {
+  b.s ^= o == '-';
+  if (ucmp(&a,&b) < 0) u = &b,v = &a;
+  i = bnew(u->n+1);
+  return bnorm(i,uadd(BD(i),u,v,a.s == b.s ? '+' : '-'),u->s);
+ }
+ if (o == '*') {
+  i = bnew(a.n+b.n);
+  umul(BD(i),&a,&b);
+  return bnorm(i,a.n+b.n,a.s^b.s);
+ }
+ if (ucmp(&a,&b) < 0) return o == '%' ? dupl(x) : flo(x)/flo(y);
+ else {
+  I q[a.n-b.n+1],r[b.n],k = o == '%' ? b.n : a.n-b.n+1;
+  udiv(q,r,&a,&b);
+  if (o == '/') for (s = 0; s < b.n; ++s) if (r[s]) return flo(x)/flo(y);
+  i = bnew(k);
+  memcpy(BD(i),o == '%' ? r : q,4*k);
+  return bnorm(i,k,a.s^(o == '/' && b.s));
+ }
+}
+/* ++ new: return x o y for o one of + - * / % when the fast path of the arithmetic primitives does not apply, using
+   exact bignum arithmetic when x and y are exact integers, otherwise double arithmetic, x must be registered with
+   rc() by the caller, garbage collects x and y */
+L arith(L x,L y,char o) {
+ L z; int64_t n,m;
+ if (o == '%' && T(x) != BIG && T(y) != BIG) return int64(x,&n) && int64(y,&m) && m ? m == -1 ? 0 : n%m : ERR;
+ rc(&y,y);
+ if (exact(x) && exact(y) && (y != 0 || (o != '/' && o != '%'))) z = big(x,y,o);
+ else if (o == '%') z = ERR;
+ else z = num(o == '+' ? flo(x)+flo(y) : o == '-' ? flo(x)-flo(y) : o == '*' ? flo(x)*flo(y) : flo(x)/flo(y));
+ gc(x); rg(1);
+ return z;
+}
+/* ++ new: negate bignum x in place when it is not shared, otherwise return a negated copy of bignum x */
+L bneg(L x) {
+ I i = ord(x),j;
+ if (VR(i) == 1 && i >= fv) return vec[i+1].x = box(RAW,ord(vec[i+1].x)^1),x;
+ rc(&x,x);
+ j = bnew(BN(i));
+ memcpy(BD(j),BD(i),4*BN(i));
+ vec[j+1].x = box(RAW,2*BN(i)+!BS(i));
+ rg(1);
+ return box(BIG,j);
+}
+/* ++ new: compare numbers x and y when one or both are bignums, returns <0, 0 or >0 */
+int bigcmp(L x,L y) {
+ struct big a,b;
+ if (!exact(x) || !exact(y)) return flo(x) < flo(y) ? -1 : flo(x) > flo(y);
+ limbs(x,&a); limbs(y,&b);
+ if (a.s != b.s) return a.s ? -1 : 1;
+ return a.s ? -ucmp(&a,&b) : ucmp(&a,&b);
+}
+/* ++ new: returns the bignum or double of the decimal integer string s with an optional sign */
+L bigstr(const char *s) {
+ I i,n = 0,k,m,d; uint64_t c; const char *p = s+(*s == '-' || *s == '+');
+ i = bnew(strlen(p)/9+1);
+ while (*p) {                                           /* multiply by 10^9 and add the next 9 digits */
+  for (d = 0,m = 1; *p && m < 1000000000; m *= 10) d = 10*d+*p++-'0';
+  for (c = d,k = 0; k < n; ++k,c >>= 32) BD(i)[k] = c += (uint64_t)BD(i)[k]*m;
+  if (c) BD(i)[n++] = c;
+ }
+ return bnorm(i,n,*s == '-');
+}
+/* ++ new: format bignum x in s[] with room for 10*BN(ord(x))+2 chars, returns the length of the string */
+I bigfmt(char *s,L x) {
+ I i = ord(x),n = BN(i),d[n],k; uint64_t c; char *p = s+10*n+1;
+ memcpy(d,BD(i),4*n);
+ for (*p = '\0'; n; ) {                                 /* divide by 10^9 to produce the next 9 digits */
+  for (c = 0,k = n; k-- > 0; c %= 1000000000) c = c<<32|d[k],d[k] = c/1000000000;
+  while (n && !d[n-1]) --n;
+  for (k = 0; k < 9 && (n || c); ++k,c /= 10) *--p = '0'+c%10;
+ }
+ if (BS(i)) *--p = '-';
+ k = s+10*BN(i)+1-p;
+ memmove(s,p,k+1);
+ return k;
+}
+
 /* section 6 lisp primitives (optimized with evarg per section 16.4) */
 L f_eval(L t,L *e) { I a = 0; L x,y = eval(rc(&x,evarg(&t,e,&a)),*e); rg(1); return y; }
-L f_quote(L t,L *_) { return dup(car(t)); }
+L f_quote(L t,L *_) { return dupl(car(t)); }
 L f_cons(L t,L *e) { I a = 0; L x,p; rc(&x,evarg(&t,e,&a)); p = cons(x,evarg(&t,e,&a)); rr(1); return p; }
-L f_car(L t,L *e) { I a = 0; L x = evarg(&t,e,&a),y = dup(car(x)); gc(x); return y; }
-L f_cdr(L t,L *e) { I a = 0; L x = evarg(&t,e,&a),y = dup(cdr(x)); gc(x); return y; }
-L f_add(L t,L *e) { I a = 0; L x,n = gc(evarg(&t,e,&a)); while (isarg(&t,e,&a,&x)) n += gc(x); return num(n); }
-L f_sub(L t,L *e) { I a = 0; L x,n = gc(evarg(&t,e,&a)); while (isarg(&t,e,&a,&x)) n -= gc(x); return num(n); }
-L f_mul(L t,L *e) { I a = 0; L x,n = gc(evarg(&t,e,&a)); while (isarg(&t,e,&a,&x)) n *= gc(x); return num(n); }
-L f_div(L t,L *e) { I a = 0; L x,n = gc(evarg(&t,e,&a)); while (isarg(&t,e,&a,&x)) n /= gc(x); return num(n); }
-L f_int(L t,L *e) { I a = 0; L n = gc(evarg(&t,e,&a)); return n < 1e16 && n > -1e16 ? (int64_t)n : num(n); }
+L f_car(L t,L *e) { I a = 0; L x = evarg(&t,e,&a),y = dupl(car(x)); gc(x); return y; }
+L f_cdr(L t,L *e) { I a = 0; L x = evarg(&t,e,&a),y = dupl(cdr(x)); gc(x); return y; }
+/* ++ updated: + - * and / of doubles with a fast path when the result is within 2^53 in magnitude or is NAN, otherwise
+   arith() computes exact bignum results of integers and double results of other numbers */
+L f_add(L t,L *e) {
+ I a = 0; L x,y,n;
+ for (rc(&n,val(evarg(&t,e,&a))); isarg(&t,e,&a,&x); ) n = fabs(y = n+(x = val(x))) < 0x1p53 ? y : arith(n,x,'+');
+ rr(1);
+ return n;
+}
+L f_sub(L t,L *e) {
+ I a = 0; L x,y,n;
+ for (rc(&n,val(evarg(&t,e,&a))); isarg(&t,e,&a,&x); ) n = fabs(y = n-(x = val(x))) < 0x1p53 ? y : arith(n,x,'-');
+ rr(1);
+ return n;
+}
+L f_mul(L t,L *e) {
+ I a = 0; L x,y,n;
+ for (rc(&n,val(evarg(&t,e,&a))); isarg(&t,e,&a,&x); ) n = fabs(y = n*(x = val(x))) < 0x1p53 ? y : arith(n,x,'*');
+ rr(1);
+ return n;
+}
+L f_div(L t,L *e) {
+ I a = 0; L x,n;
+ for (rc(&n,val(evarg(&t,e,&a))); isarg(&t,e,&a,&x); ) n = T(n) != BIG && T(x = val(x)) != BIG ? n/x : arith(n,x,'/');
+ rr(1);
+ return T(n) == BIG ? n : num(n);
+}
+L f_int(L t,L *e) { I a = 0; L n = val(evarg(&t,e,&a)); return T(n) != BIG && n < 1e16 && n > -1e16 ? (int64_t)n : n; }
 /* ++ updated: (< x y [z ...]) returns #t if x < y and y < z ... etc when given, otherwise returns () */
+char *txt(L);
 I lt(L x,L y) {
- return (T(x) == ATOM && T(y) == ATOM ? strcmp(A+ord(x),A+ord(y)) < 0 :
+ char *p,*q;
+ return ((p = txt(x)) && (q = txt(y)) ? strcmp(p,q) < 0 :
      x == x && y == y ? x < y :
+     isnum(x) && isnum(y) ? bigcmp(x,y) < 0 :         /* ++ new: compare bignums */
      T(x) < T(y) || (T(x) == T(y) && ord(x) < ord(y)));
 }
-L f_lt(L t,L *e) {
- I a = 0; L x,y;
- for (x = gc(evarg(&t,e,&a)); isarg(&t,e,&a,&y); x = y) if (!lt(x,gc(y))) return nil;
- return tru;
+/* ++ new: cmp(t,e,o) compares successive arguments with lt(), o = 0 for <, 1 for >, 2 for >= and 3 for <=, keeps x
+   until compared with the next argument y, since x may be a string or bignum that is freed when garbage collected */
+L cmp(L t,L *e,I o) {
+ I a = 0,k = 1; L x,y;
+ for (rc(&x,evarg(&t,e,&a)); k && isarg(&t,e,&a,&y); gc(x),x = y) k = (o&1 ? lt(y,x) : lt(x,y)) ^ (o>>1);
+ rg(1);
+ return k ? tru : nil;
 }
+L f_lt(L t,L *e) { return cmp(t,e,0); }
 L f_eq(L t,L *e) { I a = 0; L x = gc(evarg(&t,e,&a)); return equ(cede(x),cede(gc(evarg(&t,e,&a)))) ? tru : nil; }
 L f_pair(L t,L *e) { I a = 0; L x = gc(evarg(&t,e,&a)); return T(x) == CONS ? tru : nil; }
 L f_or(L t,L *e) { I a = 0; L x = nil; while (isarg(&t,e,&a,&x) && not(x)) continue; return x; }
@@ -409,34 +857,45 @@ L f_leta(L t,L *e) {
   else err(2,CAR(t));                           /* bound variable must be an atom, to prevent GC issues when not an atom */
  return car(t);
 }
-L f_lambda(L t,L *e) { return closure(dup(car(t)),dup(opt(t)),equ(*e,env) ? nil : dup(*e)); }
+L f_lambda(L t,L *e) { return closure(dupl(car(t)),dupl(opt(t)),equ(*e,env) ? nil : dupl(*e)); }
 /* section 17.1-2: early binding and efficient macro expansion with hygienic macros */
 /* ++ new: garbage collect the old unreachable definitions when redefined */
 L f_define(L t,L *e) {
  L d = env,v = car(t);
- if (T(v) == PRIM) printf("not redefined built-in ");
+ ++dn;
+ if (T(v) == PRIM) fputs("not redefined built-in ",con());
  else if (T(v) != ATOM && T(v) != CLOS && T(v) != MACR) return err(2,v);
  else {
   L x = eval(opt(t),*e);
   if (T(v) == CLOS || T(v) == MACR) {
-   if (T(x) != T(v)) { gc(x); printf("cannot redefine "); return dup(v); }
-   gc(CAR(v)); CAR(v) = dup(CAR(x)); gc(CDR(v)); CDR(v) = dup(CDR(x)); gc(x);
-   printf("redefined ");
-   return dup(v);
+   if (T(x) != T(v)) { gc(x); fputs("cannot redefine ",con()); return dupl(v); }
+   if (ord(v) >= fz) {                          /* ++ new: a frozen function is redefined by name */
+    while (T(d) == CONS && !equ(v,CDR(CAR(d)))) d = CDR(d);
+    if (T(d) != CONS) { gc(x); fputs("cannot redefine ",con()); return dupl(v); }
+    env = pair(v = CAR(CAR(d)),x,env);
+    fputs("redefined ",con());
+    return v;
+   }
+   dirty(v); gc(CAR(v)); CAR(v) = dupl(CAR(x)); gc(CDR(v)); CDR(v) = dupl(CDR(x)); gc(x); ++dt;
+   fputs("redefined ",con());
+   return dupl(v);
   }
   while (T(d) == CONS && !equ(v,car(CAR(d)))) d = CDR(d);
-  if (T(d) == CONS) {
-   gc(CDR(CAR(d))); CDR(CAR(d)) = x;
-   printf("redefined ");
+  if (T(d) == CONS && ord(CAR(d)) < fz) {
+   dirty(CAR(d)); gc(CDR(CAR(d))); CDR(CAR(d)) = x; ++dt;
+   fputs("redefined ",con());
+  }
+  else {
+   if (T(d) == CONS) fputs("redefined ",con()); /* ++ new: a frozen definition is shadowed */
+   env = pair(v,x,env);
   }
-  else env = pair(v,x,env);
  }
  return v;
 }
 
 /* section 11: additional Lisp primitives (optimized with evarg per section 16.4) */
-L f_assoc(L t,L *e) { I a = 0; L v = gc(evarg(&t,e,&a)),d = evarg(&t,e,&a),x = dup(assoc(v,d)); gc(d); return x; }
-L f_env(L _,L *e) { return dup(*e); }
+L f_assoc(L t,L *e) { I a = 0; L v = gc(evarg(&t,e,&a)),d = evarg(&t,e,&a),x = dupl(assoc(v,d)); gc(d); return x; }
+L f_env(L _,L *e) { return dupl(*e); }
 L f_let(L t,L *e) {
  L d = *e;
  for (; let(t); t = CDR(t))
@@ -469,24 +928,29 @@ L f_setq(L t,L *e) {
  L d = *e,v = car(t),x = eval(opt(t),d);
  while (T(d) == CONS && !equ(v,car(CAR(d)))) d = CDR(d);
  if (T(d) != CONS) err(2,v);
+ if (ord(CAR(d)) >= fz) { gc(x); err(11,v); }
+ if (T(x) == CONS || T(x) == CLOS || T(x) == MACR) ++dt;
+ dirty(CAR(d));
  gc(CDR(CAR(d)));
- return CDR(CAR(d)) = dup(x);
+ return CDR(CAR(d)) = dupl(x);
 }
 L f_setcar(L t,L *e) {
  I a = 0; L x,p,z;
  rc(&p,evarg(&t,e,&a));
- if (T(p) != CONS) err(1,p);
- x = dup(evarg(&t,e,&a)); z = CAR(p); CAR(p) = x; gc(z); rg(1);
+ if (T(mut(p)) != CONS) err(1,p);
+ x = dupl(evarg(&t,e,&a)); z = CAR(p); dirty(p); CAR(p) = x; gc(z); rg(1);
+ if (T(x) == CONS || T(x) == CLOS || T(x) == MACR) ++dt;
  return x;
 }
 L f_setcdr(L t,L *e) {
  I a = 0; L x,p,z;
  rc(&p,evarg(&t,e,&a));
- if (T(p) != CONS) err(1,p);
- x = dup(evarg(&t,e,&a)); z = CDR(p); CDR(p) = x; gc(z); rg(1);
+ if (T(mut(p)) != CONS) err(1,p);
+ x = dupl(evarg(&t,e,&a)); z = CDR(p); dirty(p); CDR(p) = x; gc(z); rg(1);
+ if (T(x) == CONS || T(x) == CLOS || T(x) == MACR) ++dt;
  return x;
 }
-L f_macro(L t,L *_) { return macro(dup(car(t)),dup(opt(t))); }
+L f_macro(L t,L *_) { return macro(dupl(car(t)),dupl(opt(t))); }
 L f_print(L t,L *e) { I a = 0; L x; for (; isarg(&t,e,&a,&x); gc(x)) print(out,x); return nil; }
 L f_println(L t,L *e) { f_print(t,e); fputc('\n',out); return nil; }
 
@@ -495,7 +959,7 @@ L f_atomize(L t,L *e) {
  I k; L s,*p = &s;
  for (rc(p,nil); T(t) == CONS; t = CDR(t))
   p = &CDR(*p = cons(T(CAR(t)) == ATOM || T(CAR(t)) == HOLD ? CAR(t) : eval(CAR(t),*e),nil));
- *p = dup(t);                                   /* tail of s is t */
+ *p = dupl(t);                                   /* tail of s is t */
  k = atomize(s,NULL);                           /* the atom string length k, to hold atomized list of arguments */
  if (hp+k+17 > lp<<3) err(4,nil);               /* ERR 4 if the heap space is not large enough */
  atomize(s,A+hp);                               /* store the atomized arguments on the heap */
@@ -506,21 +970,54 @@ L f_atomize(L t,L *e) {
 /* ++ updated: read from file with optional pathname argument converted using atomize */
 L f_read(L t,L *e) {
  I i; L x; char c = see;
- jmp_buf savedjb;
- memcpy(savedjb,jb,sizeof(jb));
+ jmp_buf b,*o = jb;
  if (T(t) != NIL) {
   x = f_atomize(t,e);
   if (ld >= sizeof(in)/sizeof(*in) || !(in[ld++] = fopen(A+ord(x),"r"))) err(5,x);
  }
  see = 0;
- if ((i = setjmp(jb)) == 0) x = Read();
- memcpy(jb,savedjb,sizeof(jb));
+ jb = &b;
+ if ((i = setjmp(b)) == 0) x = Read();
+ jb = o;
  see = c;
  if (T(t) != NIL) fclose(in[--ld]);
- if (i) longjmp(jb,i);
+ if (i) longjmp(*jb,i);
  return x;
 }
 
+/* ++ new: (read-each <path> f) reads the list in file <path> one element at a time and applies f to each element, each
+   element is garbage collected before the next is read, so a list larger than the cell pool can be processed, returns
+   the number of elements read, note that new atoms in the file are interned and retained in the atom heap */
+L f_readeach(L t,L *e) {
+ I i,j,k = 0; L x,f,y,s = CDR(t); char c = see;
+ jmp_buf b,*o = jb;
+ CDR(t) = nil;                                  /* temporarily set cdr(t) to nil to atomize <path> only */
+ x = f_atomize(t,e);
+ CDR(t) = s;                                    /* restore cdr(t) */
+ rc(&f,eval(car(s),*e)); rc(&y,nil);             /* evaluate f before opening the file, since f may fail */
+ if (ld >= sizeof(in)/sizeof(*in) || !(in[ld] = fopen(A+ord(x),"r"))) err(5,x);
+ j = ++ld;                                      /* the file is closed by look() at EOF when ld drops below j */
+ see = 0;
+ jb = &b;
+ if ((i = setjmp(b)) == 0) {
+  if (scan() != '(') err(7,atom(buf));
+  while (scan() != ')') {
+   if (*buf == '.' && !buf[1]) err(7,atom(buf));
+   y = cons(dupl(f),cons(cons(p_quote,nil),nil));        /* construct (f (<quote> x)) to apply f to x */
+   CDR(CAR(CDR(y))) = cons(parse(),nil);
+   gc(eval(y,*e));
+   x = y; y = nil; gc(x);                       /* delete (f (<quote> x)) and element x before reading the next */
+   ++k;
+  }
+ }
+ jb = o;
+ see = c;
+ if (ld == j) fclose(in[--ld]);
+ if (i) longjmp(*jb,i);                         /* re-throw error, err() garbage collected f and y */
+ rg(2);
+ return k;
+}
+
 /* section 12: adding readline with history ++ updated: support multiple loads and nested loads */
 L f_load(L t,L *e) {
  I j,k = ld; L s,v = nil;
@@ -542,16 +1039,43 @@ L f_trace(L t,L *_) { tr = not(t) ? !tr : (I)num(car(t)); return num(tr); }
 /* section 14: error handling and exceptions */
 L f_catch(L t,L *e) {
  I i; L x,**saved[2] = {sp,xp};                 /* save old stack pointers */
- jmp_buf savedjb;
- memcpy(savedjb,jb,sizeof(jb));
+ jmp_buf b,*o = jb;                             /* ++ updated: save the pointer to the old jmp buf */
  xp = sp;                                       /* set exception stack pointer xp = sp */
- if ((i = setjmp(jb)) == 0) x = eval(car(t),*e);
- memcpy(jb,savedjb,sizeof(jb));
+ jb = &b;
+ if ((i = setjmp(b)) == 0) x = eval(car(t),*e);
+ jb = o;
  rg(sp-xp);                                     /* deregister and garbage collect "lost" variables */
  sp = saved[0]; xp = saved[1];                  /* restore stack pointers */
- return i == 0 ? x : i == 4 || i == 6 ? err(i,nil) : cons(atom("ERR"),i);
+ if (i) ++dt;                                   /* unregistered cells lost by the error are collected by rebuild() */
+ return i == 0 ? x : et ? rethrow(i) : i == 4 || i == 6 ? err(i,nil) : cons(atom("ERR"),i);
 }
 L f_throw(L t,L *_) { return err(num(car(t)),nil); }
+/* ++ new: (call/ec f) calls f with a one-shot escape continuation k, calling (k x) in the dynamic extent of f returns x
+   from (call/ec f) at once, unwinding the loads, outputs and catches in between, k is the closure (lambda (ERR)
+   (escape/ec n ERR)) with the number n of the frame, calling k after (call/ec f) returned throws ERR 3 */
+I pk;                                           /* the index of primitive escape/ec */
+L f_callec(L t,L *e) {
+ I i; L f,k,x; struct esc s = {++en,nil,sp,es}; jmp_buf b,*o = jb;
+ rc(&f,eval(car(t),*e));
+ rc(&k,cons(box(PRIM,pk),cons(s.n,cons(ERR,nil))));
+ k = closure(cons(ERR,nil),k,nil);
+ es = &s; jb = &b;
+ if ((i = setjmp(b)) == 0) x = apply(f,1,&k,*e);
+ jb = o; es = s.up;
+ if (i == 0) { rg(2); return x; }
+ if (et != &s) return rethrow(i);               /* an error or an escape to an enclosing frame */
+ et = NULL;                                     /* rethrow() garbage collected f, k and "lost" variables */
+ ++dt;                                          /* unregistered cells lost by the escape are collected by rebuild() */
+ return s.x;
+}
+L f_escapeec(L t,L *e) {
+ struct esc *p; L x;
+ for (p = es; p && !equ(p->n,car(t)); p = p->up) continue;
+ if (!p) return err(3,car(t));                  /* the frame of the continuation is no longer active */
+ x = eval(car(cdr(t)),*e);
+ p->x = x; et = p;
+ return rethrow(12);
+}
 
 /* section 16.5: tail-call optimization */
 L f_progn(L t,L *e) {
@@ -575,25 +1099,27 @@ L f_until(L t,L *e) {
 
 /* ++ new: write the output of print/ln of a sequence of expressions to a file, append if the filename starts with a '+' */
 L f_writeto(L t,L *e) {
- L x = cons(dup(car(t)),nil),y = nil,v = f_atomize(x,e); I i,k = *(A+ord(v)) == '+';
+ L x = cons(dupl(car(t)),nil),y = nil,v = f_atomize(x,e); I i,k = *(A+ord(v)) == '+';
  FILE *savedout = out;                          /* save old out */
- jmp_buf savedjb;                               /* save old jmp buf */
- memcpy(savedjb,jb,sizeof(jb));
+ jmp_buf b,*o = jb;                             /* ++ updated: save the pointer to the old jmp buf */
  gc(x);                                         /* garbage collect list x we atomized as v */
  if (!(out = fopen(A+ord(v)+k,k ? "a" : "w"))) err(5,v);        /* open file for writing or appending as new out */
- if ((i = setjmp(jb)) == 0) y = eval(f_progn(cdr(t),e),*e);     /* catch error in eval of progn of the rest of args */
+ jb = &b;
+ if ((i = setjmp(b)) == 0) y = eval(f_progn(cdr(t),e),*e);      /* catch error in eval of progn of the rest of args */
  fclose(out);                                   /* close out */
  out = savedout;                                /* restore old out */
- memcpy(jb,savedjb,sizeof(jb));                 /* restore old jmp buf */
- if (i) { gc(y); longjmp(jb,i); }               /* re-throw error after garbage collecting y */
+ jb = o;                                        /* restore old jmp buf */
+ if (i) { gc(y); longjmp(*jb,i); }              /* re-throw error after garbage collecting y */
  return y;
 }
 
-/* ++ new: return the type of an expression, 0 = number, 1 = atom, 2 = primitive, 3 = pair, 4 = closure, 5 = macro, 6 = nil */
-L f_type(L t,L *e) { I a = 0,k = T(cede(gc(evarg(&t,e,&a)))); return k >= ATOM && k <= NIL ? k-ATOM+1 : 0; }
+/* ++ new: return the type of an expression, 0 = number, 1 = atom, 2 = primitive, 3 = pair, 4 = closure, 5 = macro, 6 = nil,
+   7 = vector, 8 = hash table, 9 = string, 11 = future, 12 = event */
+I type(L x) { I k = T(cede(x)); return k >= ATOM && k <= NIL ? k-ATOM+1 : k >= VECT && k != BIG ? k-VECT+7 : 0; }
+L f_type(L t,L *e) { I a = 0; return type(gc(evarg(&t,e,&a))); }
 
 /* ++ new: (number? x) returns #t if x is a number */
-L f_numbert(L t,L *e) { I a = 0; L x = gc(evarg(&t,e,&a)); return x == x ? tru : nil; }
+L f_numbert(L t,L *e) { I a = 0; L x = gc(evarg(&t,e,&a)); return isnum(x) ? tru : nil; }
 
 /* ++ new: (err? x) returns #t if x is ERR (NaN) */
 L f_errt(L t,L *e) { I a = 0; L x = gc(evarg(&t,e,&a)); return equ(x,box(ATOM,0)) ? tru : nil; }
@@ -616,16 +1142,50 @@ L f_funct(L t,L *e) { I a = 0; L f = gc(evarg(&t,e,&a)); return T(f) == PRIM ||
 /* ++ new: (list ...) returns a list of its arguments (e.g. used in backquoting) */
 L f_list(L t,L *e) { return evlis(t,*e); }
 
-/* ++ new: (append ...) returns the concatenation of its list arguments as a new list (e.g. used in backquoting) */
+/* ++ new: (append ...) returns the concatenation of its list arguments as a new list (e.g. used in backquoting) ++
+   updated: copies list elements without checked car() and cdr(), the last argument is shared and not copied */
 L f_append(L t,L *e) {
  I a = 0; L x = nil,y,s,*p = &s;
- for (rc(&y,nil),rc(p,nil); isarg(&t,e,&a,&x) && !not(t); )
-  for (gc(y),y = x; !not(x); x = cdr(x)) p = &CDR(*p = cons(dup(car(x)),nil));
+ for (rc(&y,nil),rc(p,nil); isarg(&t,e,&a,&x) && !not(t); ) {
+  for (gc(y),y = x; T(x) == CONS; x = CDR(x)) p = &CDR(*p = cons(dupl(CAR(x)),nil));
+  if (!not(x)) err(1,x);
+ }
  *p = x;
  rr(1); rg(1);
  return s;
 }
 
+/* ++ new: (append! ...) and (nconc ...) return the concatenation of their list arguments by setting the last cdr of
+   each list to the next list without copying (e.g. used in backquoting), cyclic garbage may be created only when one
+   of the updated lists is shared, i.e. when a pair has a ref count other than 1 */
+L f_nconc(L t,L *e) {
+ I a = 0,k = 0; L x,q = nil,s,*p = &s;
+ for (rc(p,nil); isarg(&t,e,&a,&x); ) {
+  if (!not(*p)) err(1,*p);
+  if (T(q) == CONS && !not(x)) { dirty(mut(q)); if (k) ++dt; }
+  for (*p = x; !not(t) && T(*p) == CONS; p = &CDR(q)) k |= ref[ord(q = *p)/2] != 1;    /* the last list is not walked */
+ }
+ rr(1);
+ return s;
+}
+
+/* ++ new: (list-builder) returns a new list builder b = (() . ()), (list-add! b x1 x2 ... xk) adds x1 to xk to the
+   end of the list (car b) in constant time per element and returns b, (cdr b) is the last pair of the list */
+L f_listbuilder(L t,L *_) { return cons(nil,nil); }
+L f_listadd(L t,L *e) {
+ I a = 0; L b,x,y;
+ rc(&b,evarg(&t,e,&a));
+ if (T(mut(b)) != CONS || (T(CDR(b)) != CONS && !not(CDR(b)))) err(1,b);
+ for (dirty(b); isarg(&t,e,&a,&x); CDR(b) = dupl(y)) {
+  if (T(x) == CONS || T(x) == CLOS || T(x) == MACR) ++dt;
+  y = cons(x,nil);
+  if (not(CDR(b))) CAR(b) = y;
+  else { dirty(CDR(b)); gc(CDR(CDR(b))); CDR(CDR(b)) = y; gc(CDR(b)); }
+ }
+ rr(1);
+ return b;
+}
+
 /* ++ new: (length t) returns the length of list t */
 L f_length(L t,L *e) {
  I a = 0,k = 0; L s = evarg(&t,e,&a);
@@ -638,14 +1198,14 @@ L f_length(L t,L *e) {
 L f_nthcdr(L t,L *e) {
  I a = 0,i = (I)num(gc(evarg(&t,e,&a))); L s = evarg(&t,e,&a);
  for (t = s; i > 0; --i) t = cdr(t);
- t = dup(t);
+ t = dupl(t);
  gc(s);
  return t;
 }
 
 /* ++ new: (nth n t) returns n'th item in list t */
 L f_nth(L t,L *e) {
- L s = f_nthcdr(t,e),x = dup(car(s));
+ L s = f_nthcdr(t,e),x = dupl(car(s));
  gc(s);
  return x;
 }
@@ -656,7 +1216,7 @@ L f_last(L t,L *e) {
  rc(&x,evarg(&t,e,&a));
  n = isarg(&t,e,&a,&y) ? (int)num(gc(y)) : 1;
  for (t = s = x; T(t) == CONS; t = CDR(t)) if (n < 1) s = CDR(s); else --n;
- s = dup(s);
+ s = dupl(s);
  rg(1);
  return s;
 }
@@ -664,59 +1224,76 @@ L f_last(L t,L *e) {
 /* ++ new: (reverse t) returns reversed copy of list t */
 L f_reverse(L t,L *e) {
  I a = 0; L x,s = nil;
- for (rc(&x,evarg(&t,e,&a)),t = x; T(t) == CONS; t = CDR(t)) s = cons(dup(CAR(t)),s);
+ for (rc(&x,evarg(&t,e,&a)),t = x; T(t) == CONS; t = CDR(t)) s = cons(dupl(CAR(t)),s);
  rg(1);
  return s;
 }
 
-/* ++ new: (seq n m) returns list with the sequence (n n+1 n+2 ... m-1) */
+/* ++ new: (seq n m) returns list with the sequence (n n+1 n+2 ... m-1) ++ updated: constructed from the last list element
+   back to the first, because the free cell pairs are listed from high to low addresses, so the list runs up in memory */
 L f_seq(L t,L *e) {
- I a = 0; int n = (int)num(gc(evarg(&t,e,&a))),m = (int)num(gc(evarg(&t,e,&a))); L s,*p = &s;
- for (rc(p,nil); n < m; ++n) p = &CDR(*p = cons(n,nil));
- rr(1);
+ I a = 0; int n = (int)num(gc(evarg(&t,e,&a))),m = (int)num(gc(evarg(&t,e,&a))); L s = nil;
+ while (m > n) s = cons(--m,s);
  return s;
 }
 
-/* ++ new: (range n m k) returns list with the sequence (n n+k n+2k ... m-1) where optional k=1 by default */
+/* ++ new: (range n m k) returns list with the sequence (n n+k n+2k ... m-1) where optional k=1 by default ++ updated:
+   constructed from the last list element back to the first like seq */
 L f_range(L t,L *e) {
- I a = 0; int n = (int)num(gc(evarg(&t,e,&a))),m = (int)num(gc(evarg(&t,e,&a))),k = 1; L x,s,*p = &s;
+ I a = 0; int n = (int)num(gc(evarg(&t,e,&a))),m = (int)num(gc(evarg(&t,e,&a))),k = 1; L x,s = nil;
  if (isarg(&t,e,&a,&x)) k = (int)num(gc(x));
- for (rc(p,nil); k*m > k*n; n += k) p = &CDR(*p = cons(n,nil));
- rr(1);
+ if (k*m > k*n) for (m = n+(m-n-(k > 0 ? 1 : -1))/k*k; k*m >= k*n; m -= k) s = cons(m,s);
  return s;
 }
 
 /* ++ new: (equal? x y) deep check for equality, recurses up to lg(n) for n cons pairs, does not permit cyclic data */
 I equal(L x,L y) {
  while (!equ(x,y) && T(x) == T(y) && (T(x) == CONS || T(x) == CLOS || T(x) == MACR)) {
-  L u = CAR(x),v = CAR(y); x = CDR(x); y = CDR(y);
+  L u = CAR(x),v = CAR(y);
+  if (he[ord(x)/2] == ep && he[ord(y)/2] == ep && hc[ord(x)/2] != hc[ord(y)/2]) return 0;     /* ++ new: hashes differ */
+  x = CDR(x); y = CDR(y);
   if (T(u) != CONS && T(u) != CLOS && T(u) != MACR) {
-   if (!equ(u,v)) return 0;
+   if (T(u) >= VECT || T(v) >= VECT ? !equal(u,v) : !equ(u,v)) return 0;
   }
   else if (T(x) != CONS && T(x) != CLOS && T(x) != MACR) {
-   if (!equ(x,y)) return 0;
+   if (T(x) >= VECT || T(y) >= VECT ? !equal(x,y) : !equ(x,y)) return 0;
    x = u; y = v;
   }
   else if (!equal(u,v)) return 0;
  }
+ if (T(x) == VECT && T(y) == VECT && !equ(x,y)) {       /* ++ new: vectors are equal when their elements are equal */
+  I i = ord(x),j = ord(y),k;
+  if (VK(i) != VK(j)) return 0;
+  for (k = 1; k <= VK(i); ++k) if (!equal(vec[i+k].x,vec[j+k].x)) return 0;
+  return 1;
+ }
+ if (T(x) == BIG || T(y) == BIG) return isnum(x) && isnum(y) && !bigcmp(x,y);  /* ++ new: bignums are equal when = */
+ if (T(x) == STR || T(y) == STR) {                      /* ++ new: strings are equal to strings and atoms with the same text */
+  char *p = txt(x),*q = txt(y);
+  return p && q && !strcmp(p,q);
+ }
  return equ(x,y);
 }
 L f_equal(L t,L *e) {
  I a = 0; L x,y,z;
  rc(&x,evarg(&t,e,&a));
  y = evarg(&t,e,&a);
- z = equal(x,y) ? tru : nil;
+ z = equal(x,y) ? tru : nil;                    /* ++ new: equal() compares the hashes of pairs when cached */
  gc(y); rg(1);
  return z;
 }
 
 /* ++ new: (member x t) returns rest of list t from the first list element that is equal to x */
 L f_member(L t,L *e) {
- I a = 0; L s,x;
+ I a = 0,h; L s,x;
  rc(&x,evarg(&t,e,&a));
  s = t = evarg(&t,e,&a);
- while (T(t) == CONS && !equal(x,CAR(t))) t = CDR(t);
- t = dup(t);
+ if (T(x) == CONS)              /* ++ new: compare the hashes of x and of pair elements, which are cached for the next search */
+  for (h = hash(x,1); T(t) == CONS && !equ(x,CAR(t)) && (T(CAR(t)) != CONS || hash(CAR(t),1) != h || !equal(x,CAR(t))); )
+   t = CDR(t);
+ else
+  while (T(t) == CONS && !equal(x,CAR(t))) t = CDR(t);
+ t = dupl(t);
  gc(s); rg(1);
  return t;
 }
@@ -734,97 +1311,160 @@ L f_copylist(L t,L *e) {
 L f_makelist(L t,L *e) {
  I a = 0; int n = (int)num(gc(evarg(&t,e,&a))); L s = nil,x = nil;
  isarg(&t,e,&a,&x);
- while (n-- > 0) s = cons(dup(x),s);
+ while (n-- > 0) s = cons(dupl(x),s);
  gc(x);
  return s;
 }
 
 /* ++ new: (> x y [z ...]) returns #t if x > y and y > z ... etc when given, otherwise returns () */
-L f_gt(L t,L *e) {
- I a = 0; L x,y;
- for (x = gc(evarg(&t,e,&a)); isarg(&t,e,&a,&y); x = y) if (!lt(gc(y),x)) return nil;
- return tru;
-}
+L f_gt(L t,L *e) { return cmp(t,e,1); }
 
 /* ++ new: (<= x y [z ...]) returns #t if x <= y and y <= z ... etc when given, otherwise returns () */
-L f_le(L t,L *e) {
- I a = 0; L x,y;
- for (x = gc(evarg(&t,e,&a)); isarg(&t,e,&a,&y); x = y) if (lt(gc(y),x)) return nil;
- return tru;
-}
+L f_le(L t,L *e) { return cmp(t,e,3); }
 
 /* ++ new: (>= x y [z ...]) returns #t if x >= y and y >= z ... etc when given, otherwise returns () */
-L f_ge(L t,L *e) {
- I a = 0; L x,y;
- for (x = gc(evarg(&t,e,&a)); isarg(&t,e,&a,&y); x = y) if (lt(x,gc(y))) return nil;
- return tru;
-}
+L f_ge(L t,L *e) { return cmp(t,e,2); }
 
 /* ++ new: (= x y) returns #t if number x equals number y, otherwise returns () */
-L f_is(L t,L *e) { I a = 0; L x = num(gc(evarg(&t,e,&a))); return x == num(gc(evarg(&t,e,&a))) ? tru : nil; }
+L f_is(L t,L *e) {
+ I a = 0; L x,y,z;
+ rc(&x,val(evarg(&t,e,&a)));
+ y = val(evarg(&t,e,&a));
+ z = (T(x) == BIG || T(y) == BIG ? isnum(x) && isnum(y) && !bigcmp(x,y) : x == y) ? tru : nil;
+ gc(y); rg(1);
+ return z;
+}
+
+/* ++ new: int64(x,&n) sets n to the 64 bit integer part of number or bignum x and returns nonzero, returns zero when x
+   is not a number or is out of the 64 bit integer range, to avoid the undefined behavior of casting NAN or huge x */
+I int64(L x,int64_t *n) {
+ I i = ord(x); uint64_t u;
+ if (T(x) != BIG) return x >= -0x1p63 && x < 0x1p63 ? *n = (int64_t)x,1 : 0;
+ if (BN(i) > 2 || (u = (uint64_t)BD(i)[1]<<32|BD(i)[0]) > (uint64_t)INT64_MAX+BS(i)) return 0;
+ *n = BS(i) ? (int64_t)(0-u) : (int64_t)u;
+ return 1;
+}
+
+/* ++ new: i64(n) returns 64 bit integer n as a double when within 2^53 in magnitude, otherwise as a bignum */
+L i64(int64_t n) {
+ uint64_t u = n < 0 ? 0-(uint64_t)n : (uint64_t)n; I i;
+ if (u <= 0x20000000000000) return n;
+ i = bnew(2); BD(i)[0] = u; BD(i)[1] = u>>32;
+ return bnorm(i,2,n < 0);
+}
+
+/* ++ new: bshl(x,k) returns exact integer x times 2^k as a bignum or double, x must be registered with rc() */
+L bshl(L x,I k) {
+ struct big a; I i,j,n; uint64_t c = 0;
+ limbs(x,&a);
+ i = bnew(n = a.n+k/32+1);
+ memset(BD(i),0,4*(k/32));
+ for (j = 0; j < a.n; ++j,c >>= 32) BD(i)[j+k/32] = c |= (uint64_t)a.d[j]<<k%32;
+ BD(i)[n-1] = c;
+ return bnorm(i,n,a.s);
+}
+
+/* ++ new: shl(n,k) returns n shifted left by k bits when k >= 0 or right by -k bits when k < 0 */
+int64_t shl(int64_t n,int64_t k) { return k >= 64 ? 0 : k <= -64 ? n >> 63 : k >= 0 ? (int64_t)((uint64_t)n << k) : n >> -k; }
+
+/* ++ new: intop(t,e,o) applies the integer operation o to the arguments t of the integer primitives, returns an exact
+   integer, i.e. a bignum when beyond 2^53 in magnitude, or returns ERR when an argument is not a number or out of the
+   64 bit range, except that x << k is exact for any exact integer x and k >= 0 */
+L intop(L t,L *e,char o) {
+ I a = 0,k; L x,y; int64_t n,m;
+ for (rc(&x,val(evarg(&t,e,&a))); isarg(&t,e,&a,&y); x = y) {
+  k = int64(y = val(y),&m);
+  gc(y);
+  if (!k) y = ERR;
+  else if (o == '<' && m >= 0 && exact(x) && (!int64(x,&n) || m >= 63 || shl(shl(n,m),-m) != n))
+   y = bshl(x,m < 0x7fffffff ? m : 0x7fffffff);          /* exact x << m when beyond 64 bits */
+  else if (!int64(x,&n)) y = ERR;
+  else switch (o) {
+   case '<': y = i64(shl(n,m)); break;
+   case '>': y = i64(shl(n,m < -64 ? 64 : -m)); break;
+   case '&': y = i64(n & m); break;
+   case '|': y = i64(n | m); break;
+   case '~': y = i64(n ^ m); break;
+  }
+  gc(x);
+ }
+ rr(1);
+ return T(x) == BIG ? x : int64(x,&n) ? i64(n) : ERR;
+}
 
 /* ++ new: (% x y ...) modulo of dividing x by y, then by ... */
-L f_mod(L t,L *e) { I a = 0; L x; int64_t n = (int64_t)num(gc(evarg(&t,e,&a))); while (isarg(&t,e,&a,&x)) n %= (int64_t)num(gc(x)); return n; }
+L f_mod(L t,L *e) {
+ I a = 0; L x,n;
+ for (rc(&n,val(evarg(&t,e,&a))); isarg(&t,e,&a,&x); ) n = arith(n,val(x),'%');     /* ++ updated: bignum modulo */
+ rr(1);
+ return n;
+}
 
 /* ++ new: (^ x y ...) raise x to the power y then by ... */
-L f_exp(L t,L *e) { I a = 0; L x,n = gc(evarg(&t,e,&a)); while (isarg(&t,e,&a,&x)) n = pow(n,gc(x)); return num(n); }
+L f_exp(L t,L *e) { I a = 0; L x,n = dbl(evarg(&t,e,&a)); while (isarg(&t,e,&a,&x)) n = pow(n,dbl(x)); return num(n); }
 
 /* ++ new: (<< x y ...) shift signed integer x left by y and by ... */
-L f_lshift(L t,L *e) { I a = 0; L x; int64_t n = (int64_t)num(gc(evarg(&t,e,&a))); while (isarg(&t,e,&a,&x)) n <<= (int64_t)num(gc(x)); return n; }
+L f_lshift(L t,L *e) { return intop(t,e,'<'); }
 
 /* ++ new: (>> x y ...) shift signed integer x right by y and by ... */
-L f_rshift(L t,L *e) { I a = 0; L x; int64_t n = (int64_t)num(gc(evarg(&t,e,&a))); while (isarg(&t,e,&a,&x)) n >>= (int64_t)num(gc(x)); return n; }
+L f_rshift(L t,L *e) { return intop(t,e,'>'); }
 
 /* ++ new: (& x y ...) bitwise and signed integers */
-L f_bitand(L t,L *e) { I a = 0; L x; int64_t n = (int64_t)num(gc(evarg(&t,e,&a))); while (isarg(&t,e,&a,&x)) n &= (int64_t)num(gc(x)); return n; }
+L f_bitand(L t,L *e) { return intop(t,e,'&'); }
 
 /* ++ new: (| x y ...) bitwise or signed integers */
-L f_bitor(L t,L *e) { I a = 0; L x; int64_t n = (int64_t)num(gc(evarg(&t,e,&a))); while (isarg(&t,e,&a,&x)) n |= (int64_t)num(gc(x)); return n; }
+L f_bitor(L t,L *e) { return intop(t,e,'|'); }
 
 /* ++ new: (~ x y ...) bitwise xor signed integers */
-L f_bitxor(L t,L *e) { I a = 0; L x; int64_t n = (int64_t)num(gc(evarg(&t,e,&a))); while (isarg(&t,e,&a,&x)) n ^= (int64_t)num(gc(x)); return n; }
+L f_bitxor(L t,L *e) { return intop(t,e,'~'); }
 
 /* ++ new: (abs x) */
-L f_abs(L t,L *e) { I a = 0; return num(fabs(gc(evarg(&t,e,&a)))); }
+L f_abs(L t,L *e) { I a = 0; L n = val(evarg(&t,e,&a)); return T(n) == BIG ? BS(ord(n)) ? bneg(n) : n : fabs(n); }
 
 /* ++ new: (sgn x) */
-L f_sgn(L t,L *e) { I a = 0; L x = gc(evarg(&t,e,&a)); return x > 0 ? 1 : x < 0 ? -1 : 0; }
+L f_sgn(L t,L *e) {
+ I a = 0,s; L x = val(evarg(&t,e,&a));
+ if (T(x) != BIG) return x > 0 ? 1 : x < 0 ? -1 : 0;
+ s = BS(ord(x));                                /* read the sign before the bignum is garbage collected */
+ gc(x);
+ return s ? -1 : 1;
+}
 
 /* ++ new: (neg x) */
-L f_neg(L t,L *e) { I a = 0; return num(-gc(evarg(&t,e,&a))); }
+L f_neg(L t,L *e) { I a = 0; L n = val(evarg(&t,e,&a)); return T(n) == BIG ? bneg(n) : num(-n); }
 
 /* ++ new: (sqrt x) */
-L f_sqrt(L t,L *e) { I a = 0; return num(sqrt(gc(evarg(&t,e,&a)))); }
+L f_sqrt(L t,L *e) { I a = 0; return num(sqrt(dbl(evarg(&t,e,&a)))); }
 
 /* ++ new: (sin x) */
-L f_sin(L t,L *e) { I a = 0; return num(sin(gc(evarg(&t,e,&a)))); }
+L f_sin(L t,L *e) { I a = 0; return num(sin(dbl(evarg(&t,e,&a)))); }
 
 /* ++ new: (cos x) */
-L f_cos(L t,L *e) { I a = 0; return num(cos(gc(evarg(&t,e,&a)))); }
+L f_cos(L t,L *e) { I a = 0; return num(cos(dbl(evarg(&t,e,&a)))); }
 
 /* ++ new: (tan x) */
-L f_tan(L t,L *e) { I a = 0; return num(tan(gc(evarg(&t,e,&a)))); }
+L f_tan(L t,L *e) { I a = 0; return num(tan(dbl(evarg(&t,e,&a)))); }
 
 /* ++ new: (asin x) */
-L f_asin(L t,L *e) { I a = 0; return num(asin(gc(evarg(&t,e,&a)))); }
+L f_asin(L t,L *e) { I a = 0; return num(asin(dbl(evarg(&t,e,&a)))); }
 
 /* ++ new: (acos x) */
-L f_acos(L t,L *e) { I a = 0; return num(acos(gc(evarg(&t,e,&a)))); }
+L f_acos(L t,L *e) { I a = 0; return num(acos(dbl(evarg(&t,e,&a)))); }
 
 /* ++ new: (atan x) */
-L f_atan(L t,L *e) { I a = 0; return num(atan(gc(evarg(&t,e,&a)))); }
+L f_atan(L t,L *e) { I a = 0; return num(atan(dbl(evarg(&t,e,&a)))); }
 
 /* ++ new: (atan2 x y) */
-L f_atan2(L t,L *e) { I a = 0; L x = gc(evarg(&t,e,&a)); return num(atan2(x,gc(evarg(&t,e,&a)))); }
+L f_atan2(L t,L *e) { I a = 0; L x = dbl(evarg(&t,e,&a)); return num(atan2(x,dbl(evarg(&t,e,&a)))); }
 
 /* ++ new: (round x) */
-L f_round(L t,L *e) { I a = 0; return num(round(gc(evarg(&t,e,&a)))); }
+L f_round(L t,L *e) { I a = 0; L x = val(evarg(&t,e,&a)); return T(x) == BIG ? x : num(round(x)); }
 
 /* ++ new: (floor x) */
-L f_floor(L t,L *e) { I a = 0; return num(floor(gc(evarg(&t,e,&a)))); }
+L f_floor(L t,L *e) { I a = 0; L x = val(evarg(&t,e,&a)); return T(x) == BIG ? x : num(floor(x)); }
 
 /* ++ new: (ceiling x) */
-L f_ceiling(L t,L *e) { I a = 0; return num(ceil(gc(evarg(&t,e,&a)))); }
+L f_ceiling(L t,L *e) { I a = 0; L x = val(evarg(&t,e,&a)); return T(x) == BIG ? x : num(ceil(x)); }
 
 /* ++ new: (char k [n]) return a string of n (default n=1) characters with code -128 <= k <= 255 */
 L f_char(L t,L *e) {
@@ -837,31 +1477,912 @@ L f_char(L t,L *e) {
 
 /* ++ new: (code <atom> [n]) return the code 0 to 255 of a single character in an atom at the front or at an optional given index n, returns 0 when beyond the end of the atom */
 L f_code(L t,L *e) {
- I i,k,a = 0; L x,v = gc(evarg(&t,e,&a));
- k = T(v) == ATOM ? strlen(A+ord(v)) : 0;
+ I i,k,a = 0; L x,v; char *s;
+ rc(&v,evarg(&t,e,&a));
+ k = (s = txt(v)) ? strlen(s) : 0;
  i = isarg(&t,e,&a,&x) ? (I)num(gc(x)) : 0;
- return i < k ? *(A+ord(v)+i)&0xff : 0;
+ k = i < k ? s[i]&0xff : 0;
+ rg(1);
+ return k;
 }
 
 /* ++ new: (cpos <atom> <atom> [n]) return character position of the first <atom> in the second <atom> or nil (), look after position n */
 L f_cpos(L t,L *e) {
- I i,a = 0; L x,v = gc(evarg(&t,e,&a)),w = gc(evarg(&t,e,&a));
+ I i,a = 0; L x,v,w,n = nil; char *p,*q;
+ rc(&v,evarg(&t,e,&a)); rc(&w,evarg(&t,e,&a));
  i = isarg(&t,e,&a,&x) ? (I)num(gc(x)) : 0;
- if (T(v) == ATOM && T(w) == ATOM && i < strlen(A+ord(w))) {
-  char *s = strstr(A+ord(w)+i,A+ord(v));
-  if (s != NULL) return s-(A+ord(w));
+ if ((p = txt(v)) && (q = txt(w)) && i < strlen(q)) {
+  char *s = strstr(q+i,p);
+  if (s != NULL) n = s-q;
  }
- return nil;
+ rg(2);
+ return n;
 }
 
 /* ++ new: (clen <atom>) return character length of <atom> */
 L f_clen(L t,L *e) {
- I a = 0; L v = gc(evarg(&t,e,&a));
- return T(v) == ATOM ? strlen(A+ord(v)) : 0;
+ I a = 0; L v = evarg(&t,e,&a); char *s = txt(v); I k = s ? strlen(s) : 0;
+ gc(v);
+ return k;
+}
+
+/* ++ new: vectors, return the index i of the header vec[i] of vector x or throw err(9) if x is not a vector */
+I vidx(L x) { return T(x) == VECT ? ord(x) : err(9,x); }
+/* return the index of element n of vector x or throw err(10) if out of range */
+I velt(L x,L n) { I i = vidx(x); return n >= 0 && n < VK(i) ? i+1+(I)n : err(10,n); }
+/* (make-vector n [x]) returns a vector of n copies of optional x, x is () by default */
+L f_makevector(L t,L *e) {
+ I a = 0,i,j; L n = num(gc(evarg(&t,e,&a))),x = nil;
+ if (!(n >= 0 && n < V)) err(10,n);
+ rc(&x,nil); isarg(&t,e,&a,&x);
+ for (j = i = vnew((I)n); j < i+(I)n; ) vec[++j].x = dupl(x);
+ rg(1);
+ return box(VECT,i);
+}
+/* (vector x1 x2 ... xk) returns a vector of k elements x1 x2 ... xk */
+L f_vector(L t,L *e) {
+ I i,j,k = 0; L s,x;
+ for (x = rc(&s,evlis(t,*e)); T(x) == CONS; x = CDR(x)) ++k;
+ for (j = i = vnew(k),x = s; T(x) == CONS; x = CDR(x)) vec[++j].x = dupl(CAR(x));
+ rg(1);
+ return box(VECT,i);
+}
+/* (vector-length v) returns the number of elements of vector v */
+L f_vectorlength(L t,L *e) { I a = 0; return VK(vidx(gc(evarg(&t,e,&a)))); }
+/* (vector-ref v n) returns element n of vector v, where the first element has index 0 */
+L f_vectorref(L t,L *e) {
+ I a = 0; L v,x;
+ rc(&v,evarg(&t,e,&a));
+ x = dupl(vec[velt(v,num(gc(evarg(&t,e,&a))))].x);
+ rg(1);
+ return x;
+}
+/* (vector-set! v n x) sets element n of vector v to x, returns x */
+L f_vectorset(L t,L *e) {
+ I a = 0,i; L v,x,z;
+ rc(&v,mut(evarg(&t,e,&a)));
+ i = velt(v,num(gc(evarg(&t,e,&a))));
+ x = dupl(evarg(&t,e,&a)); z = vec[i].x; vec[i].x = x; gc(z); rg(1);
+ stale();                                       /* vectors have no cached hashes, but pairs containing vector v may */
+ if (T(x) == CONS || T(x) == CLOS || T(x) == MACR || T(x) >= VECT) ++dt;
+ return x;
+}
+/* (vector->list v) returns a list of the elements of vector v */
+L f_vectorlist(L t,L *e) {
+ I a = 0,i,j; L v,s;
+ for (rc(&v,evarg(&t,e,&a)),rc(&s,nil),i = vidx(v),j = i+VK(i); j > i; --j) s = cons(dupl(vec[j].x),s);
+ rr(1); rg(1);
+ return s;
+}
+/* (list->vector t) returns a vector of the elements of list t */
+L f_listvector(L t,L *e) {
+ I a = 0,i,j,k = 0; L s,x;
+ for (x = rc(&s,evarg(&t,e,&a)); T(x) == CONS; x = CDR(x)) ++k;
+ for (j = i = vnew(k),x = s; T(x) == CONS; x = CDR(x)) vec[++j].x = dupl(CAR(x));
+ rg(1);
+ return box(VECT,i);
+}
+
+/* ++ new: SIMD numeric vector primitives over vectors of numbers, which are packed arrays of doubles vec[i+1..i+k].x,
+   the kernels use AVX with 4 doubles or SSE2 with 2 doubles per instruction when the CPU supports it at runtime,
+   otherwise the scalar kernels are used, compile with -DSIMD=1 for scalar kernels only, -DSIMD=2 for SSE2 at most */
+/* r[j] = a[j*sa] o b[j*sb] for j = 0 to n-1 with o one of + - * / or r[j] = sqrt(a[j*sa]) when o is 's', where a
+   stride sa or sb of 0 broadcasts the number a[0] or b[0], canonicalizes NaN results to NAN with num() */
+void vbin1(L *r,L *a,L *b,I n,I sa,I sb,char o) {
+ I j;
+ for (j = 0; j < n; ++j) {
+  L x = a[j*sa],y = b[j*sb];
+  r[j] = num(o == '+' ? x+y : o == '-' ? x-y : o == '*' ? x*y : o == '/' ? x/y : sqrt(x));
+ }
+}
+/* return the sum of a[0..n-1] or the sum of the products a[j]*b[j] when b is not NULL */
+L vred1(L *a,L *b,I n) {
+ I j; L s = 0;
+ for (j = 0; j < n; ++j) s += b ? a[j]*b[j] : a[j];
+ return s;
+}
+#if SIMD > 1 && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+/* the SIMD kernels vbin<W> and vred<W> for vector type V of W doubles with intrinsics prefix P and NaN test U<W>, the
+   lanes of NaN results are replaced by NAN, the last n%W elements are computed by the scalar kernels */
+#define U4(x) _mm256_cmp_pd(x,x,_CMP_UNORD_Q)
+#define U2(x) _mm_cmpunord_pd(x,x)
+#define KERNELS(W,V,P,A) \
+A void vbin##W(L *r,L *a,L *b,I n,I sa,I sb,char o) { \
+ I j; V x,y,z = P##set1_pd(NAN); \
+ for (j = 0; j+W <= n; j += W) { \
+  x = sa ? P##loadu_pd(a+j) : P##set1_pd(*a); \
+  y = sb ? P##loadu_pd(b+j) : P##set1_pd(*b); \
+  x = o == '+' ? P##add_pd(x,y) : o == '-' ? P##sub_pd(x,y) : o == '*' ? P##mul_pd(x,y) : \
+      o == '/' ? P##div_pd(x,y) : P##sqrt_pd(x); \
+  y = U##W(x); \
+  P##storeu_pd(r+j,P##or_pd(P##andnot_pd(y,x),P##and_pd(y,z))); \
+ } \
+ vbin1(r+j,a+j*sa,b+j*sb,n-j,sa,sb,o); \
+} \
+A L vred##W(L *a,L *b,I n) { \
+ I j,k; L s[W],t; V x = P##setzero_pd(); \
+ for (j = 0; j+W <= n; j += W) x = P##add_pd(x,b ? P##mul_pd(P##loadu_pd(a+j),P##loadu_pd(b+j)) : P##loadu_pd(a+j)); \
+ P##storeu_pd(s,x); \
+ for (t = vred1(a+j,b ? b+j : NULL,n-j),k = 0; k < W; ++k) t += s[k]; \
+ return t; \
+}
+KERNELS(4,__m256d,_mm256_,__attribute__((target("avx"))))
+KERNELS(2,__m128d,_mm_,__attribute__((target("sse2"))))
+#endif
+/* the kernels vbin and vred are selected at startup by vsimd() for the widest SIMD instructions the CPU supports */
+void (*vbin)(L*,L*,L*,I,I,I,char) = vbin1; L (*vred)(L*,L*,I) = vred1;
+void vsimd() {
+#if SIMD > 1 && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+ __builtin_cpu_init();
+ if (SIMD > 2 && __builtin_cpu_supports("avx")) vbin = vbin4,vred = vred4;
+ else if (__builtin_cpu_supports("sse2")) vbin = vbin2,vred = vred2;
+#endif
+}
+/* (vadd u v), (vsub u v), (vmul u v) and (vdiv u v) return a new vector with the sums, differences, products or
+   quotients of the elements of vectors u and v of equal length, or of a vector and a number, (vmap-sqrt u) returns a
+   new vector with the square roots of the elements of vector u */
+L vop(L t,L *e,char o) {
+ I a = 0,i,k; L x,y;
+ rc(&x,evarg(&t,e,&a)); rc(&y,o == 's' ? dupl(x) : evarg(&t,e,&a));
+ if (T(x) != VECT && (x != x || T(y) != VECT)) err(9,x);
+ if (T(y) != VECT && y != y) err(9,y);
+ k = VK(ord(T(x) == VECT ? x : y));
+ if (T(x) == VECT && T(y) == VECT && VK(ord(y)) != k) err(10,y);
+ i = vnew(k);
+ vbin(&vec[i+1].x,T(x) == VECT ? &vec[ord(x)+1].x : &x,T(y) == VECT ? &vec[ord(y)+1].x : &y,k,T(x) == VECT,T(y) == VECT,o);
+ rg(2);
+ return box(VECT,i);
+}
+L f_vadd(L t,L *e) { return vop(t,e,'+'); }
+L f_vsub(L t,L *e) { return vop(t,e,'-'); }
+L f_vmul(L t,L *e) { return vop(t,e,'*'); }
+L f_vdiv(L t,L *e) { return vop(t,e,'/'); }
+L f_vsqrt(L t,L *e) { return vop(t,e,'s'); }
+/* (vdot u v) returns the sum of the products of the elements of vectors u and v of equal length, (vsum u) returns the
+   sum of the elements of vector u, the order of the additions differs from a loop over the elements */
+L vfold(L t,L *e,I d) {
+ I a = 0; L x,y,n;
+ rc(&x,evarg(&t,e,&a)); rc(&y,d ? evarg(&t,e,&a) : dupl(x));
+ if (VK(vidx(x)) != VK(vidx(y))) err(10,y);
+ n = vred(&vec[ord(x)+1].x,d ? &vec[ord(y)+1].x : NULL,VK(ord(x)));
+ rg(2);
+ return num(n);
+}
+L f_vdot(L t,L *e) { return vfold(t,e,1); }
+L f_vsum(L t,L *e) { return vfold(t,e,0); }
+
+/* ++ new: hash tables, a hash table h is a block of four elements in the vec[] arena: vec[h+1] the number of entries,
+   vec[h+2] the number of used slots including deleted entries, vec[h+3] nonzero for equal? keys instead of eq? keys and
+   vec[h+4] the table vector with a key vec[j] and value vec[j+1] per slot, empty and deleted key slots are NONE and GONE */
+#define NONE box(NIL,1)
+#define GONE box(NIL,2)
+/* return the index i of the header vec[i] of hash table h or throw err(9) if h is not a hash table */
+I hidx(L h) { return T(h) == HASH ? ord(h) : err(9,h); }
+/* return the 32 bit hash of the bits u */
+I mix(uint64_t u) { u ^= u>>33; u *= 0xff51afd7ed558ccdULL; u ^= u>>33; return u; }
+/* ++ new: return the structural hash of pair cell[i] cached in hc[i/2], when not cached compute the hashes of the pair and
+   its cdr pairs from the end of the list back to the pair, temporarily using hc[] to link each pair to the previous pair,
+   closures and macros are not walked, since they are cyclic when they refer to themselves */
+I phash(I i) {
+ I j = 0,h;
+ while (he[i/2] != ep) {                        /* walk the list until the end or a pair with a cached hash */
+  hc[i/2] = j; j = i;
+  if (T(cell[i]) != CONS) break;
+  i = ord(cell[i]);
+ }
+ if (!j) return hc[i/2];
+ for (h = i == j ? hash(cell[i],1) : hc[i/2]; j; j = i) {
+  i = hc[j/2];
+  h = hc[j/2] = mix(((uint64_t)hash(cell[j+1],1)<<32|h)^(uint64_t)T(cell[j])<<16);
+  he[j/2] = ep;
+ }
+ return h;
+}
+/* return the hash of x, a structural hash consistent with equal? when m is nonzero, otherwise consistent with eq? */
+I hash(L x,I m) {
+ union { L x; uint64_t i; } u; I h = 0,i; char *s;
+ if (m) {
+  if ((s = txt(x))) {                           /* hash the text of atoms and strings, which may be equal */
+   for (h = 2166136261U; *s; ++s) h = (h^(unsigned char)*s)*16777619U;
+   return mix(h);
+  }
+  if (T(x) == CONS) return mix((uint64_t)T(x)<<32|phash(ord(x)));
+  if (T(x) == CLOS || T(x) == MACR) return mix(T(x));  /* hash the tag only, equal closures may differ in identity */
+  if (T(x) == BIG) x = flo(x);                  /* hash a bignum as its double, which may be equal */
+  if (T(x) == VECT) {                           /* hash the elements of a vector, but not its ordinal */
+   for (i = ord(x)+1; i <= ord(x)+VK(ord(x)); ++i) h = mix(((uint64_t)h<<32|VECT)^hash(vec[i].x,m));
+   return h;
+  }
+ }
+ if (T(x) == BIG) {                             /* hash the sign and limbs of a bignum, which may be equal */
+  for (h = BS(ord(x)),i = 0; i < BN(ord(x)); ++i) h = mix((uint64_t)h<<32^BD(ord(x))[i]);
+  return h;
+ }
+ u.x = x;
+ return mix(u.i^h*0x9e3779b97f4a7c15ULL);
+}
+/* return the index j of the slot vec[j] in hash table h with key k, or of the empty or deleted slot to insert k */
+I hfind(I h,L k) {
+ I i = ord(vec[h+4].x),m = vec[h+3].x,n = VK(i)/2-1,j = hash(k,m)&n,d = 0;
+ while (!equ(vec[i+2*j+1].x,NONE)) {
+  if (equ(vec[i+2*j+1].x,GONE)) { if (!d) d = i+2*j+1; }
+  else if (m || T(k) == BIG ? equal(vec[i+2*j+1].x,k) : equ(vec[i+2*j+1].x,k)) return i+2*j+1;
+  j = (j+1)&n;
+ }
+ return d ? d : i+2*j+1;
+}
+/* resize hash table h to a new table vector with c slots (c is a power of two), moving the entries and dropping GONE */
+void hsize(I h,I c) {
+ I i = vnew(2*c),j,k,n = c-1; L t = vec[h+4].x;
+ for (j = i+1; j <= i+2*c; j += 2) vec[j].x = NONE,vec[j+1].x = nil;
+ vec[h+4].x = box(VECT,i);
+ if (T(t) == VECT) {
+  for (j = ord(t)+1; j <= ord(t)+VK(ord(t)); j += 2)
+   if (T(vec[j].x) != NIL || !ord(vec[j].x)) {
+    for (k = hash(vec[j].x,vec[h+3].x)&n; !equ(vec[i+2*k+1].x,NONE); k = (k+1)&n) continue;
+    vec[i+2*k+1].x = vec[j].x; vec[i+2*k+2].x = vec[j+1].x;
+   }
+  VR(ord(t)) = FREE;                            /* delete the old table vector without collecting the moved entries */
+ }
+ vec[h+2].x = vec[h+1].x;
+}
+/* (make-hash [x]) returns a new empty hash table with equal? keys when x is given and not (), otherwise eq? keys */
+L f_makehash(L t,L *e) {
+ I a = 0,h; L x = nil;
+ if (isarg(&t,e,&a,&x)) gc(x);
+ h = vnew(4); vec[h+1].x = 0; vec[h+2].x = 0; vec[h+3].x = !not(x); vec[h+4].x = nil;
+ rc(&x,box(HASH,h));
+ hsize(h,8);
+ rr(1);
+ return x;
+}
+/* (hash-ref h k [x]) returns the value of key k in hash table h or optional x when not found, x is () by default */
+L f_hashref(L t,L *e) {
+ I a = 0,j; L h,k,x = nil;
+ rc(&h,evarg(&t,e,&a)); rc(&k,evarg(&t,e,&a));
+ j = hfind(hidx(h),k);
+ if (T(vec[j].x) != NIL || !ord(vec[j].x)) x = dupl(vec[j+1].x); else isarg(&t,e,&a,&x);
+ rg(2);
+ return x;
+}
+/* (hash-set! h k x) sets the value of key k in hash table h to x, returns x */
+L f_hashset(L t,L *e) {
+ I a = 0,i,j; L h,k,x,z;
+ rc(&h,evarg(&t,e,&a)); rc(&k,evarg(&t,e,&a)); rc(&x,evarg(&t,e,&a));
+ i = hidx(mut(h));
+ if (4*(vec[i+2].x+1) > 3*VK(ord(vec[i+4].x))/2) {                     /* resize when more than 3/4 of the slots are used */
+  for (j = 8; 2*(vec[i+1].x+1) > j; j *= 2) continue;
+  hsize(i,j);
+ }
+ j = hfind(i,k);
+ if (T(vec[j].x) != NIL || !ord(vec[j].x)) { z = vec[j+1].x; vec[j+1].x = dupl(x); gc(z); }
+ else {
+  if (equ(vec[j].x,NONE)) ++vec[i+2].x;
+  ++vec[i+1].x;
+  vec[j].x = dupl(k); vec[j+1].x = dupl(x);
+ }
+ if (T(x) == CONS || T(x) == CLOS || T(x) == MACR || T(x) >= VECT) ++dt;
+ rr(1); rg(2);
+ return x;
+}
+/* (hash-remove! h k) removes key k from hash table h, returns #t if removed, otherwise () */
+L f_hashremove(L t,L *e) {
+ I a = 0,i,j; L h,k,x = nil;
+ rc(&h,evarg(&t,e,&a)); rc(&k,evarg(&t,e,&a));
+ j = hfind(i = hidx(mut(h)),k);
+ if (T(vec[j].x) != NIL || !ord(vec[j].x)) {
+  gc(vec[j].x); gc(vec[j+1].x); vec[j].x = GONE; vec[j+1].x = nil;
+  --vec[i+1].x;
+  x = tru;
+ }
+ rg(2);
+ return x;
+}
+/* (hash-count h) returns the number of entries in hash table h */
+L f_hashcount(L t,L *e) { I a = 0; return vec[hidx(gc(evarg(&t,e,&a)))+1].x; }
+/* (hash->list h) returns a list of the (k . x) entries in hash table h, to iterate over the entries */
+L f_hashlist(L t,L *e) {
+ I a = 0,i,j; L h,s;
+ rc(&h,evarg(&t,e,&a)); rc(&s,nil);
+ for (i = ord(vec[hidx(h)+4].x),j = i+VK(i); j > i; j -= 2)
+  if (T(vec[j-1].x) != NIL || !ord(vec[j-1].x)) s = cons(cons(dupl(vec[j-1].x),dupl(vec[j].x)),s);
+ rr(1); rg(1);
+ return s;
+}
+
+/* ++ new: strings, a string is a block in the vec[] arena with length vec[i+1] = box(RAW,k) followed by k chars and a \0,
+   strings are not interned in the atom heap, string arguments may be atoms or strings */
+/* return the text of atom or string x, or NULL if x is not an atom or string */
+char *txt(L x) { return T(x) == ATOM ? A+ord(x) : T(x) == STR ? (char*)&vec[ord(x)+2] : NULL; }
+/* return a new string with the k chars at s, s should not point into a string that is not registered */
+L string(const char *s,I k) {
+ I i = vnew(k/sizeof(L)+2);
+ vec[i+1].x = box(RAW,k);
+ memcpy((char*)&vec[i+2],s,k);
+ ((char*)&vec[i+2])[k] = '\0';
+ return box(STR,i);
+}
+/* (string? x) returns #t if x is a string */
+L f_stringt(L t,L *e) { I a = 0; L x = gc(evarg(&t,e,&a)); return T(x) == STR ? tru : nil; }
+/* (string-append x1 x2 ... xk) returns a new string with the concatenated text of atoms, strings and numbers x1 ... xk */
+L f_stringappend(L t,L *e) {
+ I i,k = 0; L s,x; char *p;
+ for (x = rc(&s,evlis(t,*e)); T(x) == CONS; x = CDR(x))
+  if ((p = txt(CAR(x)))) k += strlen(p); else if (isnum(CAR(x))) k += atomize(CAR(x),NULL); else err(9,CAR(x));
+ i = vnew(k/sizeof(L)+2);
+ vec[i+1].x = box(RAW,k);
+ for (p = (char*)&vec[i+2],x = s; T(x) == CONS; x = CDR(x))
+  if (txt(CAR(x))) p = stpcpy(p,txt(CAR(x))); else p += atomize(CAR(x),p);
+ *p = '\0';
+ rg(1);
+ return box(STR,i);
+}
+/* (substring s n [m]) returns a new string with the chars from index n up to but not including m of atom or string s,
+   m is the length of s by default */
+L f_substring(L t,L *e) {
+ I a = 0,k; L x,y,n,m; char *p;
+ rc(&x,evarg(&t,e,&a));
+ if (!(p = txt(x))) err(9,x);
+ k = strlen(p);
+ n = num(gc(evarg(&t,e,&a)));
+ m = isarg(&t,e,&a,&y) ? num(gc(y)) : k;
+ if (!(n >= 0 && n <= m && m <= k)) err(10,n);
+ y = string(txt(x)+(I)n,(I)m-(I)n);
+ rg(1);
+ return y;
+}
+/* (string-length s) returns the number of chars of atom or string s */
+L f_stringlength(L t,L *e) {
+ I a = 0; L x = gc(evarg(&t,e,&a));
+ return T(x) == STR ? ord(vec[ord(x)+1].x) : T(x) == ATOM ? strlen(A+ord(x)) : err(9,x);
+}
+/* (string->symbol s) returns the atom (symbol) interned with the text of string s */
+L f_stringsymbol(L t,L *e) {
+ I a = 0; L x,y;
+ rc(&x,evarg(&t,e,&a));
+ if (!txt(x)) err(9,x);
+ y = atom(txt(x));
+ rg(1);
+ return y;
+}
+
+/* ++ new: bulk list primitives, apply f to the elements of the list(s) with apply() instead of eval() of an application */
+/* (map f t1 t2 ... tk) returns the list of f applied to the first elements of t1 ... tk, then to the second elements and so
+   on, until the shortest list ends, (for-each f t1 t2 ... tk) does the same for side effects and returns () */
+L mapping(L t,L *e,I m) {
+ I i,j,k = 0; L s,b,r,z,*x,*p = &r;
+ rc(&s,evlis(t,*e));
+ for (z = cdr(s); T(z) == CONS; z = CDR(z)) ++k;
+ j = vnew(2*k+1); vec[j+1].x = box(RAW,2*k);    /* the elements x[] and the rest x[k+i] of the lists in a raw block */
+ rc(&b,box(VECT,j)); rc(p,nil);
+ x = &vec[j+2].x;
+ for (i = 0,z = CDR(s); i < k; z = CDR(z)) x[k+i++] = CAR(z);
+ while (k) {
+  for (i = 0; i < k && T(x[k+i]) == CONS; ++i) x[i] = CAR(x[k+i]),x[k+i] = CDR(x[k+i]);
+  if (i < k) break;
+  z = apply(CAR(s),k,x,*e);
+  if (m) gc(z); else p = &CDR(*p = cons(z,nil));
+ }
+ rr(1); rg(2);
+ return r;
+}
+L f_map(L t,L *e) { return mapping(t,e,0); }
+L f_foreach(L t,L *e) { return mapping(t,e,1); }
+/* (filter f t) returns the list of elements x of list t for which (f x) is not () */
+L f_filter(L t,L *e) {
+ L s,r,x,y,*p = &r;
+ rc(&s,evlis(t,*e)); rc(p,nil);
+ for (y = car(cdr(s)); T(y) == CONS; y = CDR(y))
+  if (x = CAR(y),!not(gc(apply(CAR(s),1,&x,*e)))) p = &CDR(*p = cons(dupl(CAR(y)),nil));
+ rr(1); rg(1);
+ return r;
+}
+/* (foldl f x t) returns (f xn ... (f x2 (f x1 x))) for list t = (x1 x2 ... xn), (foldr f x t) returns (f x1 (f x2 ... (f xn x))) */
+L folding(L t,L *e,I m) {
+ L s,r,z,y,x[2];
+ rc(&s,evlis(t,*e)); rc(&r,nil);
+ y = car(cdr(cdr(s)));
+ if (m) for (; T(y) == CONS; y = CDR(y)) r = cons(dupl(CAR(y)),r);               /* reverse the list for foldr */
+ for (rc(&z,dupl(CAR(CDR(s)))),y = m ? r : y; T(y) == CONS; y = CDR(y)) {
+  x[0] = CAR(y); x[1] = z;
+  x[1] = apply(CAR(s),2,x,*e); gc(z); z = x[1];
+ }
+ rr(1); rg(2);
+ return z;
+}
+L f_foldl(L t,L *e) { return folding(t,e,0); }
+L f_foldr(L t,L *e) { return folding(t,e,1); }
+/* return nonzero if x is less than y by the less-than function f, or by < when f is () */
+I less(L f,L x,L y,L e) { L z[2]; z[0] = x; z[1] = y; return not(f) ? lt(x,y) : !not(gc(apply(f,2,z,e))); }
+/* (sort t [f]) returns a sorted copy of list t using less-than function f, or < by default, a stable merge sort */
+L f_sort(L t,L *e) {
+ I a = 0,i,j,k,m,n = 0,w,lo,hi; L s,f,u,v,r;
+ rc(&s,evarg(&t,e,&a)); rc(&f,nil); isarg(&t,e,&a,&f);
+ for (r = s; T(r) == CONS; r = CDR(r)) ++n;
+ rc(&u,box(VECT,i = vnew(n)));                  /* move the elements between vectors u and v, so each is held only once */
+ for (r = s; T(r) == CONS; r = CDR(r)) vec[++i].x = dupl(CAR(r));
+ rc(&v,box(VECT,i = vnew(n)));
+ while (n > i-ord(v)) vec[++i].x = nil;
+ for (w = 1; w < n; w *= 2,r = u,u = v,v = r) {
+  for (lo = 0; lo < n; lo += 2*w) {
+   m = lo+w < n ? lo+w : n; hi = lo+2*w < n ? lo+2*w : n;
+   for (i = ord(u)+1+lo,j = ord(u)+1+m,k = ord(v)+1+lo; k < ord(v)+1+hi; ++k)
+    if (j < ord(u)+1+hi && (i >= ord(u)+1+m || less(f,vec[j].x,vec[i].x,*e))) vec[k].x = vec[j].x,vec[j++].x = nil;
+    else vec[k].x = vec[i].x,vec[i++].x = nil;
+  }
+ }
+ for (rc(&r,nil),i = ord(u)+n; i > ord(u); --i) r = cons(vec[i].x,r),vec[i].x = nil;
+ rr(1); rg(4);
+ return r;
+}
+
+/* ++ new: parallel map with an interpreter instance per thread, values are deep copied between instances */
+API struct lisp *newlisp(); API void freelisp(struct lisp*);
+/* memo table t[n] with k entries of the copies y of the closures, macros, pairs and blocks x of the instance with cells
+   pc[], refs pr[], blocks pv[] and atom heap pointer ph that may be shared, so they are copied once, pairs and blocks with
+   a ref count of 1 are not shared, but closures may be, because references in cycles through closures are not counted,
+   atoms below b are the same in both instances and other atoms are interned by name, futures and events are copied as ()
+   when u is nonzero, since they cannot be copied */
+struct memo { L *pc; I *pr; union block *pv; I ph,b,z,w,n,k,u; struct { L x,y; } *t; };
+/* start memo table m to copy from instance c, ++ new: the frozen pairs from z and blocks below w are shared when both
+   instances are clones of the same template */
+void from(struct memo *m,struct lisp *c,I b) {
+ struct lisp *o = cx; I g = fg;
+ cx = c; m->pc = cell; m->pr = ref; m->pv = vec; m->ph = hp; m->z = g && g == fg ? fz : N; m->w = g && g == fg ? fv : 0; cx = o;
+ m->b = b; m->n = m->k = m->u = 0; m->t = NULL;
+}
+/* return a pointer to the copy of x in memo table m, which is 0 when x was not copied yet */
+L *memo(struct memo *m,L x) {
+ I i,j;
+ if (2*(m->k+1) > m->n) {                       /* grow the table when half full */
+  struct memo o = *m;
+  m->n = o.n ? 2*o.n : 64; m->k = 0;
+  if (!(m->t = calloc(m->n,sizeof(*m->t)))) err(4,nil);
+  for (i = 0; i < o.n; ++i) if (!equ(o.t[i].x,0)) *memo(m,o.t[i].x) = o.t[i].y;
+  free(o.t);
+ }
+ for (j = ord(x)*2654435761U&(m->n-1); !equ(m->t[j].x,0) && !equ(m->t[j].x,x); j = (j+1)&(m->n-1)) continue;
+ if (equ(m->t[j].x,0)) m->t[j].x = x,++m->k;
+ return &m->t[j].y;
+}
+/* copy x of the instance of memo m to *p in the current instance, the copy is constructed in place, reachable from *p */
+void copy(struct memo *m,L x,L *p) {
+ while (1) {
+  I t = T(x),i = ord(x),j,k; L *q = NULL;
+  if (t == ATOM || t == HOLD) { *p = i < m->b ? x : box(t,ord(atom((char*)m->pc+i))); return; }
+  if (t != CONS && t != CLOS && t != MACR && t < VECT) { *p = x; return; }
+  if (t < VECT ? i >= m->z : i < m->w) { *p = x; return; }
+  if ((t == CONS ? m->pr[i/2] : t >= VECT ? m->pv[i].h[1] : 0) != 1 && !equ(*(q = memo(m,x)),0)) { *p = dupl(*q); return; }
+  if (t == FUT || t == EVT) { if (m->u) { *p = nil; return; } err(9,x); }     /* a future or an event cannot be copied */
+  if (t >= VECT) {
+   *p = box(t,j = vnew(k = m->pv[i].h[0]));
+   if (q) *q = *p;
+   if (k && T(m->pv[i+1].x) == RAW) { memcpy(&vec[j+1],&m->pv[i+1],k*sizeof(L)); return; }
+   for (k = 1; k <= VK(j); ++k) vec[j+k].x = nil;
+   for (k = 1; k <= VK(j); ++k) copy(m,m->pv[i+k].x,&vec[j+k].x);
+   if (t == HASH) hsize(j,VK(ord(vec[j+4].x))/2);       /* rehash the keys, eq? keys are hashed by their ordinals */
+   return;
+  }
+  *p = box(t,ord(cons(nil,nil)));
+  if (q) *q = *p;
+  copy(m,m->pc[i+1],&CAR(*p));
+  p = &CDR(*p); x = m->pc[i];
+ }
+}
+/* copy the atoms of the instance of memo m that follow the atoms of the current instance, which must be its first atoms */
+void atoms(struct memo *m) {
+ if (m->ph <= hp) return;
+ if (m->ph+16 > lp<<3) err(4,nil);
+ memcpy(A+hp,(char*)m->pc+hp,m->ph-hp);
+ hp = m->ph;
+}
+/* pmap state shared by the threads: instance o with global environment d applies f to the n elements x[], the next element
+   to take is k, result y[i] is computed by instance w[i] */
+struct pmap { struct lisp *o,**w; L d,f,*x,*y; I n; atomic_uint k; };
+/* pmap thread running instance c with memo table m of copies and d of an element, e is the error code and x the value
+   of an error */
+struct pjob { struct pmap *p; struct lisp *c; struct memo m,d; I e; L x; };
+/* pmap thread: copy the atoms, the global environment and f of instance o, then apply f to copies of the elements */
+void *pwork(void *a) {
+ struct pjob *w = a; struct pmap *p = w->p; I i; L f,x,r; jmp_buf b;
+ cx = w->c; jb = &b; batch = 3;                 /* the error is reported by pmap, not by the thread */
+ eb = NULL; ex = xp; ey = nil;                  /* keep the value of an error in ey */
+ if ((w->e = setjmp(b))) {
+  w->x = ey;
+  atomic_store(&p->k,p->n);                     /* stop the other threads after an error */
+  return NULL;
+ }
+ from(&w->m,p->o,0); w->m.b = w->m.ph;
+ atoms(&w->m);
+ gc(env); env = nil; w->m.u = 1; copy(&w->m,p->d,&env); w->m.u = 0;  /* global futures and events are () */
+ rc(&f,nil); copy(&w->m,p->f,&f);
+ rc(&r,nil); rc(&x,nil);
+ while ((i = atomic_fetch_add(&p->k,1)) < p->n) {
+  w->d = w->m; w->d.n = w->d.k = 0; w->d.t = NULL;      /* copy each element with a new memo table */
+  copy(&w->d,p->x[i],&x);
+  free(w->d.t); w->d.t = NULL;
+  r = cons(p->y[i] = apply(f,1,&x,env),r);      /* keep the result in r until it is copied back */
+  p->w[i] = cx;
+  gc(x); x = nil;
+ }
+ return NULL;
+}
+/* (pmap f t [n]) returns the list of f applied to the elements of list t in parallel by n threads, one per core by default,
+   each thread runs a new interpreter instance with a copy of the global environment, f and the elements of t, the results
+   are copied back, so f should not depend on side effects, global futures and events are () in the copy */
+L f_pmap(L t,L *e) {
+ I a = 0,i,j,k,n = 0; L f,s,r,x,*q = &r; struct pmap p; struct pjob *w; pthread_t *h;
+ rc(&f,evarg(&t,e,&a)); rc(&s,evarg(&t,e,&a));
+ k = isarg(&t,e,&a,&x) ? (I)num(gc(x)) : (I)sysconf(_SC_NPROCESSORS_ONLN);
+ for (x = s; T(x) == CONS; x = CDR(x)) ++n;
+ if (k > n) k = n;
+ if (k < 1) k = 1;
+ p.o = cx; p.d = env; p.f = f; p.n = n; atomic_init(&p.k,0);
+ p.x = malloc(n*sizeof(L)); p.y = malloc(n*sizeof(L)); p.w = malloc(n*sizeof(struct lisp*));
+ w = calloc(k,sizeof(struct pjob)); h = malloc(k*sizeof(pthread_t));
+ for (i = 0,x = s; p.x && i < n; ++i,x = CDR(x)) p.x[i] = CAR(x);
+ for (j = 0; p.x && p.y && p.w && w && h && j < k; ++j) {
+  w[j].p = &p;
+  if (!(w[j].c = newlisp())) break;
+  if (pthread_create(&h[j],NULL,pwork,&w[j])) { freelisp(w[j].c); break; }
+ }
+ for (k = j,i = j ? 0 : 4,j = 0; j < k; ++j) {
+  pthread_join(h[j],NULL);
+  if (w[j].e) i = w[j].e;
+  free(w[j].m.t); free(w[j].d.t);
+  from(&w[j].m,w[j].c,hp);                      /* copy the results back with the atoms below hp the same */
+ }
+ rc(&r,nil);
+ for (j = 0; !i && j < n; ++j) {
+  for (a = 0; p.w[j] != w[a].c; ++a) continue;
+  *q = cons(nil,nil); copy(&w[a].m,p.y[j],&CAR(*q)); q = &CDR(*q);
+ }
+ for (j = 0; i && j < k; ++j) if (w[j].e) { copy(&w[j].m,w[j].x,&r); break; }   /* copy the value of the first error */
+ for (j = 0; j < k; ++j) {
+  if (w[j].m.k) ++dt;                           /* the results may share cyclic closures */
+  free(w[j].m.t); freelisp(w[j].c);
+ }
+ free(p.x); free(p.y); free(p.w); free(w); free(h);
+ if (i) err(i,r);                               /* report the value of the error of the thread */
+ rr(1); rg(2);
+ return r;
+}
+
+/* ++ new: futures evaluated in parallel by a work-stealing scheduler of threads with an interpreter instance per thread,
+   values cross instances marshalled to a compact byte string */
+/* byte string s[n] of size z, marshal appends bytes at s[n], unmarshal reads the byte at s[k] */
+struct bytes { char *s; size_t k,n,z; };
+/* remembered values r[k] of size n of unmarshal */
+struct refs { L *r; I k,n; };
+/* append k bytes s to byte string b */
+void bput(struct bytes *b,const void *s,size_t k) {
+ if (b->n+k > b->z) {
+  char *r = realloc(b->s,2*(b->n+k)+64);
+  if (!r) err(4,nil);
+  b->s = r; b->z = 2*(b->n+k)+64;
+ }
+ memcpy(b->s+b->n,s,k); b->n += k;
+}
+void bchr(struct bytes *b,char c) { bput(b,&c,1); }
+/* append u to byte string b as a varint of 7 bits per byte with the high bit set to continue */
+void buint(struct bytes *b,uint64_t u) { char c; do c = u&127,u >>= 7,bchr(b,u ? c|128 : c); while (u); }
+/* marshal x to byte string b, the format is a sequence of the following marshalled values, u is a varint:
+     i u      integer number with zigzag encoded u    n d      other number, the 8 bytes of double d
+     (        nil                                     ) u      NIL-tagged sentinel with ordinal u
+     a s      atom with 0-terminated name s           h s      held atom with 0-terminated name s
+     p u      primitive u                             e        the global environment
+     g s      global closure or macro named s         r u      the u'th remembered closure, macro, pair or block
+     c x y    pair (x . y)                            l x y    closure (x . y), m x y is a macro (x . y)
+     v t u .. block with tag VECT+t/2 of u values, or of u raw 8-byte words when t is odd
+     &        remembers the next closure, macro, pair or block, which is a closure, macro, pair or block with a ref count
+              other than 1, numbered in the memo table m
+   the global environment is marshalled with e and g when g is nonzero, returns zero when x holds a future, which is
+   marshalled as () */
+I marshal(struct bytes *b,struct memo *m,L x,I g) {
+ I ok = 1;
+ while (1) {
+  I t = T(x),i = ord(x),j; L *q,d;
+  if (x == x) {
+   int64_t n = x >= -0x1p62 && x < 0x1p62 ? (int64_t)x : 0;
+   if (x == n && (n || !signbit(x))) bchr(b,'i'),buint(b,(uint64_t)n<<1^(uint64_t)(n>>63));
+   else bchr(b,'n'),bput(b,&x,sizeof(L));
+   return ok;
+  }
+  if (g && equ(x,env)) { bchr(b,'e'); return ok; }
+  if (t == NIL) { if (i) bchr(b,')'),buint(b,i); else bchr(b,'('); return ok; }
+  if (t == ATOM || t == HOLD) { bchr(b,t == ATOM ? 'a' : 'h'); bput(b,A+i,strlen(A+i)+1); return ok; }
+  if (t == PRIM) { bchr(b,'p'); buint(b,i); return ok; }
+  if (t == FUT || t == EVT) { bchr(b,'('); return 0; }
+  if (t == CLOS || t == MACR || (t == CONS ? ref[i/2] : VR(i)) != 1) {
+   if (!equ(*(q = memo(m,x)),0)) { bchr(b,'r'); buint(b,(I)*q-1); return ok; }
+   *q = m->k;
+   bchr(b,'&');
+   if (g && t != CONS && t < VECT)              /* a global function is marshalled by name */
+    for (d = env; T(d) == CONS; d = CDR(d))
+     if (equ(CDR(CAR(d)),x) && T(CAR(CAR(d))) == ATOM) {
+      bchr(b,'g'); bput(b,A+ord(CAR(CAR(d))),strlen(A+ord(CAR(CAR(d))))+1);
+      return ok;
+     }
+  }
+  if (t >= VECT) {
+   bchr(b,'v'); bchr(b,(t-VECT)*2+raw(i)); buint(b,VK(i));
+   if (raw(i)) bput(b,&vec[i+1],VK(i)*sizeof(L));
+   else for (j = i+1; j <= i+VK(i); ++j) ok &= marshal(b,m,vec[j].x,g);
+   return ok;
+  }
+  bchr(b,t == CONS ? 'c' : t == CLOS ? 'l' : 'm');
+  ok &= marshal(b,m,CAR(x),g);
+  x = CDR(x);
+ }
+}
+/* return the next byte or varint of byte string b */
+I bget(struct bytes *b) { return b->k < b->n ? (unsigned char)b->s[b->k++] : (I)err(7,nil); }
+uint64_t bint(struct bytes *b) { uint64_t u = 0; I c,s = 0; do c = bget(b),u |= (uint64_t)(c&127)<<s,s += 7; while (c&128); return u; }
+/* return the 0-terminated string at the current position of byte string b */
+char *bstr(struct bytes *b) { char *s = b->s+b->k,*t = memchr(s,0,b->n-b->k); if (!t) err(7,nil); b->k += t-s+1; return s; }
+/* remember x as the next remembered value r[k] */
+void keep(struct refs *r,L x) {
+ if (r->k == r->n) {
+  L *s = realloc(r->r,(r->n = 2*r->n+16)*sizeof(L));
+  if (!s) err(4,nil);
+  r->r = s;
+ }
+ r->r[r->k++] = x;
+}
+/* unmarshal a value of byte string b with remembered values r, the value is constructed in place, reachable from *p */
+void unmarshal(struct bytes *b,struct refs *r,L *p) {
+ while (1) {
+  I c = bget(b),f = c == '&',t,i,j,k; uint64_t u;
+  if (f) c = bget(b);
+  if (c == 'i') { u = bint(b); *p = (int64_t)(u>>1^-(u&1)); return; }
+  if (c == 'n') { if (b->n-b->k < sizeof(L)) err(7,nil); memcpy(p,b->s+b->k,sizeof(L)); b->k += sizeof(L); return; }
+  if (c == 'e') { *p = dupl(env); return; }
+  if (c == '(') { *p = nil; return; }
+  if (c == ')') { *p = box(NIL,bint(b)); return; }
+  if (c == 'a' || c == 'h') { *p = box(c == 'a' ? ATOM : HOLD,ord(atom(bstr(b)))); return; }
+  if (c == 'p') { *p = box(PRIM,bint(b)); return; }
+  if (c == 'r') { if ((u = bint(b)) >= r->k) err(7,nil); *p = dupl(r->r[u]); return; }
+  if (c == 'g') { *p = dupl(assoc(atom(bstr(b)),env)); if (f) keep(r,*p); return; }
+  if (c == 'v') {
+   t = bget(b); k = bint(b);
+   *p = box(VECT+t/2,i = vnew(k));
+   if (f) keep(r,*p);
+   if (t&1) {
+    if (b->n-b->k < k*sizeof(L)) err(7,nil);
+    memcpy(&vec[i+1],b->s+b->k,k*sizeof(L)); b->k += k*sizeof(L);
+    return;
+   }
+   for (j = 1; j <= k; ++j) vec[i+j].x = nil;
+   for (j = 1; j <= k; ++j) unmarshal(b,r,&vec[i+j].x);
+   if (T(*p) == HASH) hsize(i,VK(ord(vec[i+4].x))/2);  /* rehash the keys, eq? keys are hashed by their ordinals */
+   return;
+  }
+  if (c != 'c' && c != 'l' && c != 'm') err(7,nil);
+  *p = box(c == 'c' ? CONS : c == 'l' ? CLOS : MACR,ord(cons(nil,nil)));
+  if (f) keep(r,*p);
+  unmarshal(b,r,&CAR(*p));
+  p = &CDR(*p);
+ }
+}
+/* a task evaluates the marshalled thunk src and marshals its result to res or sets its error code err, then done is set,
+   uses counts the future and the scheduler referencing the task */
+struct task { struct bytes src,res; I err; atomic_int uses,done; };
+/* release a reference to task k */
+void unref(struct task *k) {
+ if (atomic_fetch_sub(&k->uses,1) > 1) return;
+ free(k->src.s); free(k->res.s); free(k);
+}
+/* release the task of future block i when freed */
+void fdrop(I i) { struct task *k; memcpy(&k,&vec[i+2],sizeof(k)); unref(k); }
+/* Chase-Lev work-stealing deque of D tasks, the owner thread pushes and pops tasks at the bottom b, other threads steal
+   tasks at the top t */
+#define D 4096
+struct deque { _Alignas(64) atomic_long t; _Alignas(64) atomic_long b; struct task *_Atomic q[D]; };
+/* snapshot s of the global environment of the home instance with version v, uses counts the threads using it */
+struct snap { struct bytes s; I v; atomic_int uses; };
+/* scheduler state: home is the instance that first created a future, with global environment ge after gd definitions
+   published in snapshot sn of version v, dq[nd] are the deques of the threads, seq is incremented when a task is pushed or
+   done to wake the w threads waiting on c */
+#define W 64
+struct {
+ struct lisp *_Atomic home; L ge; I gd,v; struct snap *sn;
+ struct deque *_Atomic dq[W]; atomic_uint nd,seq,w;
+ pthread_mutex_t m; pthread_cond_t c;
+} fs = { .m = PTHREAD_MUTEX_INITIALIZER,.c = PTHREAD_COND_INITIALIZER };
+/* the deque of this thread, the next deque to steal from, the version of the snapshot used by a worker, and fw is nonzero
+   for a worker */
+_Thread_local struct deque *mq; _Thread_local I vi,sv,fw;
+/* assign a deque to this thread, up to W threads */
+void fdeque() {
+ struct deque *d = aligned_alloc(64,sizeof(struct deque)); I i;
+ if (!d) return;
+ memset(d,0,sizeof(struct deque));
+ if ((i = atomic_fetch_add(&fs.nd,1)) < W) atomic_store(&fs.dq[i],mq = d); else free(d);
+}
+/* push task k to the deque of this thread, returns zero when full */
+I fpush(struct task *k) {
+ long b = atomic_load(&mq->b);
+ if (b-atomic_load(&mq->t) >= D) return 0;
+ atomic_store(&mq->q[b%D],k);
+ atomic_store(&mq->b,b+1);
+ return 1;
+}
+/* pop a task from the deque of this thread, returns NULL when empty */
+struct task *fpop() {
+ long b = atomic_load(&mq->b)-1,t; struct task *k;
+ atomic_store(&mq->b,b);
+ t = atomic_load(&mq->t);
+ if (t > b) { atomic_store(&mq->b,b+1); return NULL; }
+ k = atomic_load(&mq->q[b%D]);
+ if (t == b) {                                  /* race with thieves for the last task */
+  if (!atomic_compare_exchange_strong(&mq->t,&t,t+1)) k = NULL;
+  atomic_store(&mq->b,b+1);
+ }
+ return k;
+}
+/* steal a task from deque d, returns NULL when empty or lost the race to another thread */
+struct task *fsteal(struct deque *d) {
+ long t = atomic_load(&d->t),b = atomic_load(&d->b); struct task *k;
+ if (t >= b) return NULL;
+ k = atomic_load(&d->q[t%D]);
+ return atomic_compare_exchange_strong(&d->t,&t,t+1) ? k : NULL;
+}
+/* returns the next task to run, popped from the deque of this thread or stolen from another, NULL when none */
+struct task *fnext() {
+ struct task *k = mq ? fpop() : NULL; struct deque *d; I i,n = atomic_load(&fs.nd);
+ if (n > W) n = W;
+ for (i = 0; !k && i < n; ++i) if ((d = atomic_load(&fs.dq[(vi+i)%n])) && d != mq) k = fsteal(d);
+ ++vi;
+ return k;
+}
+/* wake the waiting threads after a task is pushed or done */
+void fready() {
+ atomic_fetch_add(&fs.seq,1);
+ if (!atomic_load(&fs.w)) return;
+ pthread_mutex_lock(&fs.m); pthread_cond_broadcast(&fs.c); pthread_mutex_unlock(&fs.m);
+}
+/* wait until a task is pushed or done after seq was s */
+void fidle(I s) {
+ pthread_mutex_lock(&fs.m);
+ atomic_fetch_add(&fs.w,1);
+ while (atomic_load(&fs.seq) == s) pthread_cond_wait(&fs.c,&fs.m);
+ atomic_fetch_sub(&fs.w,1);
+ pthread_mutex_unlock(&fs.m);
+}
+/* release a reference to snapshot s */
+void unsnap(struct snap *s) { if (s && atomic_fetch_sub(&s->uses,1) == 1) free(s->s.s),free(s); }
+/* publish a snapshot of the global environment of the home instance when changed by definitions */
+void fpublish() {
+ struct snap *s,*o; struct memo m = {0};
+ if (fs.sn && equ(env,fs.ge) && dn == fs.gd) return;
+ if (!(s = calloc(1,sizeof(struct snap)))) err(4,nil);
+ marshal(&s->s,&m,env,0);                       /* futures in the global environment are marshalled as () */
+ free(m.t);
+ atomic_init(&s->uses,1);
+ fs.ge = env; fs.gd = dn;
+ pthread_mutex_lock(&fs.m); s->v = ++fs.v; o = fs.sn; fs.sn = s; pthread_mutex_unlock(&fs.m);
+ unsnap(o);
+}
+/* update the global environment of a worker to the last published snapshot */
+void fupdate() {
+ struct snap *s; struct bytes b; struct refs r = {0}; L x;
+ pthread_mutex_lock(&fs.m);
+ if ((s = fs.sn) && s->v != sv) atomic_fetch_add(&s->uses,1); else s = NULL;
+ pthread_mutex_unlock(&fs.m);
+ if (!s) return;
+ b = s->s; b.k = 0;
+ rc(&x,nil); unmarshal(&b,&r,&x);
+ gc(env); env = x; rr(1);
+ sv = s->v;
+ free(r.r); unsnap(s);
+}
+/* ++ new: marshal the value x of an error of the running task to eb, replacing a partial result, or keep x in ey */
+void fail(L x) {
+ struct memo m = {0};
+ ex = NULL;
+ if (!eb) { ey = dupl(x); return; }
+ eb->n = 0;                                     /* an error in marshal() is not marshalled */
+ marshal(eb,&m,x,1);
+ free(m.t);
+}
+/* run task k, its errors are not reported but returned by touch with the value of the error */
+void frun(struct task *k) {
+ I i; L f,x,**saved[2] = {sp,xp},**u = ex; jmp_buf j,*o = jb; struct esc *q = es; struct bytes b = k->src,*v = eb;
+ struct refs r = {0}; struct memo m = {0};
+ rc(&f,nil); rc(&x,nil);
+ xp = sp;
+ jb = &j; es = NULL;                            /* a continuation cannot escape from a task */
+ eb = &k->res; ex = xp;
+ if ((i = setjmp(j)) == 0) {
+  if (fw) fupdate();
+  b.k = 0; unmarshal(&b,&r,&f);
+  x = apply(f,0,NULL,env);
+  if (!marshal(&k->res,&m,x,1)) err(9,x);       /* a future cannot be returned by a future */
+ }
+ jb = o; es = q; eb = v; ex = u;
+ rg(sp-saved[0]);                               /* garbage collect f, x and "lost" variables */
+ sp = saved[0]; xp = saved[1];
+ if (i) ++dt;                                   /* unregistered cells lost by the error are collected by rebuild() */
+ free(r.r); free(m.t);
+ k->err = i;
+ atomic_store(&k->done,1);
+ fready();
+ unref(k);
+}
+/* worker thread running instance a, runs the next task or waits */
+void *fwork(void *a) {
+ struct task *k; I n = 0,s;
+ cx = a; fw = 1; batch = 3;                     /* the errors of tasks are reported by touch */
+ fdeque();
+ while (1) {
+  s = atomic_load(&fs.seq);
+  if ((k = fnext())) {
+   frun(k); n = 0;
+   if (dt || 2*fn-hp/8 < N/4) rebuild();
+  }
+  else if (n++ < 64) sched_yield();
+  else fidle(s);
+ }
+ return NULL;
+}
+/* start the scheduler with the current instance as home and a worker thread per core other than this one */
+void fstart() {
+ long i,n = sysconf(_SC_NPROCESSORS_ONLN); struct lisp *c; pthread_t h; sigset_t s,o;
+ pthread_mutex_lock(&fs.m);
+ if (!atomic_load(&fs.home)) {
+  atomic_store(&fs.home,cx);
+  fdeque();
+  sigemptyset(&s); sigaddset(&s,SIGINT);
+  pthread_sigmask(SIG_BLOCK,&s,&o);             /* CTRL-C stops the home instance, not the workers */
+  for (i = 0; i < (n > 1 ? n-1 : 1) && i < W-1; ++i)
+   if ((c = newlisp())) {
+    if (pthread_create(&h,NULL,fwork,c)) { freelisp(c); break; }
+    pthread_detach(h);
+   }
+  pthread_sigmask(SIG_SETMASK,&o,NULL);
+ }
+ pthread_mutex_unlock(&fs.m);
+}
+/* (future x) returns a future of the value of x that is evaluated in parallel by another thread or when touched, x is
+   evaluated in a copy of its environment, which should not hold futures, with the global environment of the instance
+   that first created a future, futures created by other instances are evaluated right away */
+L f_future(L t,L *e) {
+ I i,j; L x,y; struct task *k; struct memo m = {0};
+ if (!atomic_load(&fs.home)) fstart();
+ rc(&x,closure(nil,dupl(car(t)),equ(*e,env) ? nil : dupl(*e)));
+ rc(&y,box(FUT,j = vnew(2))); vec[j+1].x = vec[j+2].x = nil;
+ if (cx == atomic_load(&fs.home)) fpublish();
+ if (!(k = calloc(1,sizeof(struct task)))) err(4,nil);
+ i = marshal(&k->src,&m,x,1);
+ free(m.t);
+ if (!i) { free(k->src.s); free(k); err(9,x); }
+ atomic_init(&k->uses,2);
+ vec[j+1].x = FUTURE; memcpy(&vec[j+2],&k,sizeof(k));
+ if ((cx == atomic_load(&fs.home) || fw) && mq && fpush(k)) fready();
+ else frun(k);
+ rr(1); rg(1);
+ return y;
+}
+/* (touch f) returns the value of future f, helps running tasks until its value is available */
+L f_touch(L t,L *e) {
+ I a = 0,n = 0,s; L x,y; struct task *k,*u; struct bytes b; struct refs r = {0};
+ rc(&x,evarg(&t,e,&a));
+ if (T(x) != FUT) err(9,x);
+ memcpy(&k,&vec[ord(x)+2],sizeof(k));
+ while (s = atomic_load(&fs.seq),!atomic_load(&k->done))
+  if ((u = fnext())) frun(u),n = 0;
+  else if (n++ < 64) sched_yield();
+  else fidle(s);
+ b = k->res; b.k = 0;
+ rc(&y,nil); if (b.n) unmarshal(&b,&r,&y);
+ if (r.k) ++dt;                                 /* the value may share cyclic closures */
+ free(r.r);
+ if (k->err) err(k->err,y);                     /* report the value of the error of the task */
+ rr(1); rg(1);
+ return y;
 }
 
 #ifdef TIME
-#include <sys/time.h>
 /* ++ new: (time <expr> [n]) display running time of <expr> evaluated n (default n=1) times */
 L f_time(L t,L *e) {
  L x = nil; I i,k = let(t) ? (I)num(car(CDR(t))) : 1;
@@ -882,9 +2403,130 @@ L f_time(L t,L *e) {
 }
 #endif
 
+/* ++ new: (load-extension name) loads shared object name and calls its function int initlisp(struct lisp *c) with the
+   current instance c to add the primitives of the extension with primlisp() declared in tinylisp.h, returns #t or ERR 5
+   when the shared object cannot be loaded or initlisp() returns nonzero, the shared object is never unloaded */
+L f_loadextension(L t,L *e) {
+ I a = 0; L x; char *s = txt(rc(&x,evarg(&t,e,&a))); void *h; int (*f)(struct lisp*);
+ if (!s) err(9,x);
+ if (!(h = dlopen(s,RTLD_NOW|RTLD_LOCAL)) || !(f = (int (*)(struct lisp*))dlsym(h,"initlisp"))) {
+  if (batch < 3 && (xp == stk || tr)) fprintf(con(),"\n%s",dlerror());
+  if (h) dlclose(h);
+  err(5,x);
+ }
+ if (f(cx)) err(5,x);
+ rg(1);
+ return tru;
+}
+
+/* ++ new: event loop, an event x is a block of five elements, EV(x,1) is the file descriptor to read or -1 for a timer,
+   EV(x,2) is the deadline of a timer in ms, EV(x,3) is the callback or (), EV(x,4) is the value and EV(x,5) is the state
+   () waiting, 1 ready to complete, or #t completed, the pending events are kept in list ev, the epoll instance ef-1 of
+   the event loop waits for the file descriptors to become readable */
+#define EV(v,k) vec[ord(v)+(k)].x
+/* return the time in ms */
+L now() { struct timespec s; clock_gettime(CLOCK_MONOTONIC,&s); return 1e3*s.tv_sec+1e-6*s.tv_nsec; }
+/* return a new pending event to read file descriptor n or a timer with deadline d when n < 0, with callback f registered
+   with rc() */
+L event(L n,L d,L f) {
+ I i; L x; struct epoll_event v = {EPOLLIN};
+ if (!(n >= -1 && n < 0x1p31)) err(9,n);
+ if (!ef && !(ef = epoll_create1(EPOLL_CLOEXEC)+1)) err(5,nil);
+ x = box(EVT,i = vnew(5));
+ EV(x,1) = n; EV(x,2) = d; EV(x,3) = f; EV(x,4) = EV(x,5) = nil;
+ rr(1);
+ rc(&x,x);
+ v.data.fd = n;
+ if (n >= 0 && epoll_ctl(ef-1,EPOLL_CTL_ADD,n,&v) && errno != EEXIST) EV(x,5) = 1;    /* e.g. a file is always ready */
+ ev = cons(dupl(x),ev);
+ rr(1);
+ return x;
+}
+/* return nonzero when an event is waiting to read file descriptor n */
+I reading(L n) { L d; for (d = ev; T(d) == CONS; d = CDR(d)) if (EV(CAR(d),1) == n && not(EV(CAR(d),5))) return 1; return 0; }
+/* wait up to w ms or until an event is ready when w < 0, then complete the ready events and call their callbacks, returns
+   the number of events completed */
+I events(int w) {
+ struct epoll_event r[64]; char b[16384]; L d,*p,x,y; I n = 0; int i,k = 0; ssize_t m = 0;
+ if (T(ev) != CONS) return 0;
+ for (d = ev; T(d) == CONS; d = CDR(d)) {       /* wait until the first deadline and not at all when an event is ready */
+  x = CAR(d);
+  if (!not(EV(x,5))) w = 0;
+  else if (EV(x,1) < 0) {                       /* clamp the wait to INT_MAX ms for distant deadlines */
+   y = EV(x,2)-now();
+   i = y > 0 ? y < 0x1p31-1 ? (int)y+1 : 0x7fffffff : 0;
+   w = w < 0 || i < w ? i : w;
+  }
+ }
+ while ((k = epoll_wait(ef-1,r,64,w)) < 0 && errno == EINTR) continue;
+ for (i = 0; i < k; ++i)                        /* the first event waiting for a readable file descriptor is ready */
+  for (d = ev; T(d) == CONS; d = CDR(d))
+   if (EV(CAR(d),1) == r[i].data.fd && not(EV(CAR(d),5))) { EV(CAR(d),5) = 1; break; }
+ for (y = now(),d = ev; T(d) == CONS; d = CDR(d))
+  if (EV(CAR(d),1) < 0 && not(EV(CAR(d),5)) && EV(CAR(d),2) <= y) EV(CAR(d),5) = 1;
+ for (p = &ev; T(*p) == CONS; ) {               /* complete the ready events, restart after each callback */
+  if (!equ(EV(x = CAR(*p),5),1)) { p = &CDR(*p); continue; }
+  if (EV(x,1) >= 0 && (m = read((int)EV(x,1),b,sizeof(b))) < 0 && errno == EAGAIN) {
+   EV(x,5) = nil;                               /* not readable after all */
+   p = &CDR(*p);
+   continue;
+  }
+  d = *p; *p = CDR(d); CAR(d) = CDR(d) = nil; gc(d);
+  rc(&x,x);                                     /* the pair of ev held x */
+  if (EV(x,1) >= 0) {
+   if (!reading(EV(x,1))) epoll_ctl(ef-1,EPOLL_CTL_DEL,(int)EV(x,1),NULL);
+   EV(x,4) = m > 0 ? string(b,m) : nil;
+  }
+  else EV(x,4) = tru;
+  EV(x,5) = tru;
+  ++n;
+  if (!not(EV(x,3))) gc(apply(EV(x,3),1,&EV(x,4),env));
+  rg(1);
+  p = &ev;
+ }
+ return n;
+}
+/* (async-read fd [f]) returns an event that completes with a string read from file descriptor fd when it is readable, or
+   with () at the end of the file, calls f with the string or () when f is given */
+L f_asyncread(L t,L *e) {
+ I a = 0; L n = gc(evarg(&t,e,&a)),f;
+ if (!isarg(&t,e,&a,&f)) f = nil;
+ return event(n,0,rc(&f,f));
+}
+/* (timer ms [f]) returns an event that completes with #t after ms milliseconds, calls f with #t when f is given */
+L f_timer(L t,L *e) {
+ I a = 0; L n = gc(evarg(&t,e,&a)),f;
+ if (!isarg(&t,e,&a,&f)) f = nil;
+ rc(&f,f);
+ if (!(n >= 0)) err(9,n);
+ return event(-1,now()+n,f);
+}
+/* (await x) returns the value of event x when completed, completes other events while waiting, returns x when x is not an
+   event */
+L f_await(L t,L *e) {
+ I a = 0; L x,y;
+ rc(&x,evarg(&t,e,&a));
+ if (T(x) != EVT) { rr(1); return x; }
+ while (!equ(EV(x,5),tru)) events(-1);
+ y = dupl(EV(x,4));
+ rg(1);
+ return y;
+}
+/* (poll [ms]) waits up to ms milliseconds or until an event is ready, completes the ready events and calls their callbacks,
+   returns the number of pending events or () when none are pending, e.g. (while (poll)) runs the event loop */
+L f_poll(L t,L *e) {
+ I a = 0,k = 0; L n,d;
+ events(isarg(&t,e,&a,&n) && gc(n) >= 0 ? n < 0x1p31 ? (int)n : 0x7fffffff : -1);
+ for (d = ev; T(d) == CONS; d = CDR(d)) ++k;
+ return k ? k : nil;
+}
+
 L f_quit(L t,L *e) { I a = 0; L x; exit(isarg(&t,e,&a,&x) ? (int)num(x) : 0); }
 
-struct { const char *s; L (*f)(L,L*); short t; } prim[] = {
+/* ++ new: the table of P primitives, primitives added at runtime with primlisp() are appended while holding lock pm */
+#define P 512
+pthread_mutex_t pm = PTHREAD_MUTEX_INITIALIZER;
+struct { const char *s; L (*f)(L,L*); short t; } prim[P] = {
  {"eval",     f_eval,    0}, /* no longer tail recursive to implement gc */
  {"quote",    f_quote,   0},
  {"cons",     f_cons,    0},
@@ -916,17 +2558,24 @@ struct { const char *s; L (*f)(L,L*); short t; } prim[] = {
  {"set-cdr!", f_setcdr,  0},
  {"macro",    f_macro,   0},
  {"read",     f_read,    0},
+ {"read-each",f_readeach,0},
  {"print",    f_print,   0},
  {"println",  f_println, 0},
  {"load",     f_load,    0},
  {"catch",    f_catch,   0},
  {"throw",    f_throw,   0},
+ {"call/ec",  f_callec,  0},
+ {"escape/ec",f_escapeec,0},
  {"trace",    f_trace,   0},
  {"progn",    f_progn,   1},
  {"while",    f_while,   0},
  {"until",    f_until,   0},
  {"list",     f_list,    0},
  {"append",   f_append,  0},
+ {"append!",  f_nconc,   0},
+ {"nconc",    f_nconc,   0},
+ {"list-builder",f_listbuilder,0},
+ {"list-add!",f_listadd,0},
  {"atomize",  f_atomize, 0},
  {"write-to", f_writeto, 0},
  {"type",     f_type,    0},
@@ -977,6 +2626,45 @@ struct { const char *s; L (*f)(L,L*); short t; } prim[] = {
  {"code",     f_code,    0},
  {"cpos",     f_cpos,    0},
  {"clen",     f_clen,    0},
+ {"make-vector",f_makevector,0},
+ {"vector",   f_vector,  0},
+ {"vector-length",f_vectorlength,0},
+ {"vector-ref",f_vectorref,0},
+ {"vector-set!",f_vectorset,0},
+ {"vector->list",f_vectorlist,0},
+ {"list->vector",f_listvector,0},
+ {"vadd",     f_vadd,    0},
+ {"vsub",     f_vsub,    0},
+ {"vmul",     f_vmul,    0},
+ {"vdiv",     f_vdiv,    0},
+ {"vmap-sqrt",f_vsqrt,   0},
+ {"vdot",     f_vdot,    0},
+ {"vsum",     f_vsum,    0},
+ {"make-hash",f_makehash,0},
+ {"hash-ref", f_hashref, 0},
+ {"hash-set!",f_hashset, 0},
+ {"hash-remove!",f_hashremove,0},
+ {"hash-count",f_hashcount,0},
+ {"hash->list",f_hashlist,0},
+ {"string?",  f_stringt, 0},
+ {"string-append",f_stringappend,0},
+ {"substring",f_substring,0},
+ {"string-length",f_stringlength,0},
+ {"string->symbol",f_stringsymbol,0},
+ {"map",      f_map,     0},
+ {"for-each", f_foreach, 0},
+ {"filter",   f_filter,  0},
+ {"foldl",    f_foldl,   0},
+ {"foldr",    f_foldr,   0},
+ {"sort",     f_sort,    0},
+ {"pmap",     f_pmap,    0},
+ {"future",   f_future,  0},
+ {"touch",    f_touch,   0},
+ {"load-extension",f_loadextension,0},
+ {"async-read",f_asyncread,0},
+ {"timer",    f_timer,   0},
+ {"await",    f_await,   0},
+ {"poll",     f_poll,    0},
 #ifdef TIME
  {"time",     f_time,    0},
 #endif
@@ -1000,18 +2688,18 @@ void trace(L y,L x,L e) {
 L eval(L x,L e) {
  I a; L d,f,g,v,y,z;
  /* if x is an atom, then return its value; if x is not an application list (it is constant), then return x */
- if (T(x) == ATOM) return dup(assoc(x,e));
- if (T(x) != CONS) return dup(x);
+ if (T(x) == ATOM) return dupl(assoc(x,e));
+ if (T(x) != CONS) return dupl(x);
  /* pre-check for stack overflow, expect 3 + 1 (for evlis) rc() calls to register variables */
  if (sp >= stk+S-4) return err(4,nil);
- /* we dup(e) the environment to extend with locals and formal arguments */
- rc(&d,nil); rc(&e,dup(e)); rc(&g,nil);
+ /* we dupl(e) the environment to extend with locals and formal arguments */
+ rc(&d,nil); rc(&e,dupl(e)); rc(&g,nil);
  while (1) {
   /* copy x to y to output y => x when tracing is enabled */
   y = x;
   /* if x is an atom, then return its value; if x is not an application list (it is constant), then return x */
-  if (T(x) == ATOM) { x = dup(assoc(x,e)); break; }
-  if (T(x) != CONS) { x = dup(x); break; }
+  if (T(x) == ATOM) { x = dupl(assoc(x,e)); break; }
+  if (T(x) != CONS) { x = dupl(x); break; }
   /* evaluate f in the application (f . x) and get the list of arguments x */
   f = CAR(x); x = CDR(x);
   if (T(f) == ATOM) f = assoc(f,e);
@@ -1025,11 +2713,11 @@ L eval(L x,L e) {
   }
   if (T(f) != CLOS) return err(3,f);
   /* get the list of variables v of closure f and its local environment d (use global env when nil) */
-  d = dup(CDR(f)); f = CAR(f); 
-  if (T(d) == NIL) d = dup(env);
+  d = dupl(CDR(f)); f = CAR(f); 
+  if (T(d) == NIL) d = dupl(env);
   /* bind closure f variables v to the evaluated argument values */
   for (a = 0,v = CAR(f); T(v) == CONS; v = CDR(v)) d = pair(CAR(v),evarg(&x,&e,&a),d);
-  if (T(v) == ATOM) d = pair(v,a ? dup(x) : evlis(x,e),d);
+  if (T(v) == ATOM) d = pair(v,a ? dupl(x) : evlis(x,e),d);
   /* next, evaluate body x of closure f in environment e = d (use temp z in case gc() gets SIGINT) */
   x = CDR(f); z = e; e = d; d = nil; gc(z);
   if (tr) trace(y,x,e);
@@ -1042,6 +2730,33 @@ L eval(L x,L e) {
  return x;
 }
 
+/* ++ new: apply function f to k evaluated arguments x[0] to x[k-1] in environment e, returns the result, fast paths bind
+   the closure variables to the arguments directly and pass a primitive the list of arguments, quoted when not constant */
+L apply(L f,I k,L *x,L e) {
+ I i; L d,v,y,*p;
+ if (sp >= stk+S-4) return err(4,nil);
+ if (T(f) == CLOS) {
+  rc(&d,dupl(T(CDR(f)) == NIL ? env : CDR(f)));
+  for (i = 0,v = CAR(CAR(f)); T(v) == CONS; v = CDR(v),++i) d = pair(CAR(v),i < k ? dupl(x[i]) : err(8,nil),d);
+  if (T(v) == ATOM) {
+   d = pair(v,nil,d);
+   for (p = &CDR(CAR(d)); i < k; ++i) p = &CDR(*p = cons(dupl(x[i]),nil));
+  }
+  y = eval(CDR(CAR(f)),d);
+ }
+ else if (T(f) == PRIM) {
+  rc(&d,dupl(e)); rc(&v,nil);                    /* the primitive may update the list v, so it is a new list */
+  for (p = &v,i = 0; i < k; ++i)
+   p = &CDR(*p = cons(T(x[i]) == ATOM || T(x[i]) == CONS ? cons(p_quote,cons(dupl(x[i]),nil)) : dupl(x[i]),nil));
+  y = prim[ord(f)].f(v,&d);
+  if (prim[ord(f)].t) y = eval(y,d);
+  rg(1);
+ }
+ else return err(3,f);
+ rg(1);
+ return y;
+}
+
 /* section 12: adding readline with history */
 void look() {
  while (ld) {
@@ -1051,6 +2766,18 @@ void look() {
   if (c != EOF) return;
   fclose(in[--ld]);
   see = 0;
+  if (!ld && batch >= 2 && !*ptr) return;       /* ++ new: end of file loaded at the end of the string */
+ }
+ if (batch == 1) {                              /* ++ new: batch mode reads stdin, exit on EOF */
+  int c = getc(stdin);
+  if (c == EOF) exit(0);
+  see = c;
+  return;
+ }
+ if (batch >= 2) {                              /* ++ new: string mode reads ptr, syntax error past its end */
+  if (!see && !*ptr) err(7,nil);
+  if ((see = *ptr)) ++ptr;
+  return;
  }
  if (!see) {
   if (line) { ptr = line; line = NULL; free(ptr); }
@@ -1093,7 +2820,7 @@ L tick() {
  if (*buf != '(') return quote(parse());
  for (p = &CDR(rc(&t,cons(atom("list"),nil))); ; p = &CDR(*p = cons(tick(),nil))) {
   if (scan() == ')') { rr(1); return t; }
-  if (*buf == '.' && !buf[1]) { scan(); t = endl(cons(atom("append"),cons(t,cons(tick(),nil)))); rr(1); return t; }
+  if (*buf == '.' && !buf[1]) { scan(); t = endl(cons(atom("append!"),cons(t,cons(tick(),nil)))); rr(1); return t; }
  }
 }
 L parse() {
@@ -1104,7 +2831,9 @@ L parse() {
  if (*buf == '"') return quote(atom(buf+1));
  if (*buf == ',') return err(7,atom(buf));
  if (*buf == ')') return err(7,atom(buf));
- return sscanf(buf,"%lg%n",&n,&i) > 0 && !buf[i] ? n : atom(buf);
+ if (sscanf(buf,"%lg%n",&n,&i) < 1 || buf[i]) return atom(buf);
+ i = *buf == '-' || *buf == '+';
+ return fabs(n) >= 0x1p53 && !buf[i+strspn(buf+i,"0123456789")] ? bigstr(buf) : n;     /* ++ new: bignum literal */
 }
 
 /* section 17.1: early binding and efficient macro expansion */
@@ -1126,7 +2855,7 @@ L hold(L x) {
   rr(1);
   return t;
  }
- return dup(x);
+ return dupl(x);
 }
 /* check if expression x has variable (atom) v placed on HOLD */
 I holds(L v,L x) {
@@ -1165,27 +2894,27 @@ L expand(L x,L e,L b) {
  L c,d,v,w,y,z;
  if (T(x) == ATOM) {
   /* resolve the name of a variable (atom) x */
-  if (lookup(x,b,&y)) return dup(y);    /* x is a macro argument in a macro body */
-  if (lookup(x,e,&y) && (T(y) == PRIM || T(y) == CLOS || T(y) == MACR)) return dup(y);
+  if (lookup(x,b,&y)) return dupl(y);    /* x is a macro argument in a macro body */
+  if (lookup(x,e,&y) && (T(y) == PRIM || T(y) == CLOS || T(y) == MACR)) return dupl(y);
   return x;
  }
  if (T(x) == HOLD) {
   x = release(x);                       /* release variable (atom) x being held */
-  if (lookup(x,e,&y) && (T(y) == PRIM || T(y) == CLOS || T(y) == MACR)) return dup(y);
+  if (lookup(x,e,&y) && (T(y) == PRIM || T(y) == CLOS || T(y) == MACR)) return dupl(y);
   return x;
  }
  rc(&c,nil); rc(&d,nil);
  if (T(x) == CLOS) {
   /* expand the body of closure x */
   v = w = car(CAR(x));                  /* the variables v of the closure */
-  d = e = dup(CDR(x));                  /* the lexical scope of bindings d of the closure */
+  d = e = dupl(CDR(x));                  /* the lexical scope of bindings d of the closure */
   y = cdr(CAR(x));                      /* the body y of the closure */
-  if (T(d) == NIL) d = dup(env);        /* closure has global scope */
+  if (T(d) == NIL) d = dupl(env);        /* closure has global scope */
   /* closure variables v hide macro variables in b and hide global primitives and macros in d */
-  for (c = dup(b); T(v) == CONS; v = CDR(v)) d = pair(CAR(v),nil,d),c = pair(CAR(v),CAR(v),c);
+  for (c = dupl(b); T(v) == CONS; v = CDR(v)) d = pair(CAR(v),nil,d),c = pair(CAR(v),CAR(v),c);
   if (T(v) == ATOM) d = pair(v,nil,d),c = pair(v,v,c);
   /* expand the body y of the closure and create a new closure with variables w and lexical scope e */
-  z = closure(dup(w),expand(y,d,c),e);
+  z = closure(dupl(w),expand(y,d,c),e);
   rg(2);
   return z;
  }
@@ -1197,8 +2926,7 @@ L expand(L x,L e,L b) {
   x = CDR(x);
   if (T(f) == MACR) {
    /* f in (f ...) is a macro to apply by expand/eval/expand its body */
-   I i; jmp_buf savedjb;
-   memcpy(savedjb,jb,sizeof(jb));
+   I i; jmp_buf j,*o = jb;
    /* bind the variables v of macro f to the given arguments x quoted (and hold all atoms in x) in environment c */
    for (c = nil,v = release(CAR(f)); T(v) == CONS && T(x) == CONS; v = CDR(v),x = CDR(x))
     c = pair(CAR(v),quote(hold(car(x))),c);
@@ -1207,11 +2935,12 @@ L expand(L x,L e,L b) {
    /* expand macro body CDR(f) using macro arguments bound in updated environment c */
    rc(&x,expand(CDR(f),e,c));
    /* eval macro body (may fail) then expand the result with macro arguments bound in environment b */
-   if ((i = setjmp(jb)) == 0) rc(&y,eval(x,e));
-   memcpy(jb,savedjb,sizeof(jb));
+   jb = &j;
+   if ((i = setjmp(j)) == 0) rc(&y,eval(x,e));
+   jb = o;
    if (i) {
-    printf("\e[31;1mmacro expansion failed:\e[m "); print(stdout,x); printf("\n");
-    longjmp(jb,i);
+    if (!et) printf("\e[31;1mmacro expansion failed:\e[m "),print(stdout,x),printf("\n");
+    longjmp(*jb,i);
    }
    z = expand(y,e,b);
    rg(5);
@@ -1220,12 +2949,12 @@ L expand(L x,L e,L b) {
   if (T(f) == PRIM) {
    /* f is a primitive in (f ...) */
    if (equ(f,p_quote)) {                /* <quote>: release variables, but do not expand */
-    *p = release(dup(x));
+    *p = release(dupl(x));
     rr(1); rg(2);
     return t;
    }
    if (equ(f,p_macro)) {                /* <macro>: expand body */
-    *p = cons(dup(car(x)),cons(expand(opt(x),e,b),nil));
+    *p = cons(dupl(car(x)),cons(expand(opt(x),e,b),nil));
     rr(1); rg(2);
     return t;
    }
@@ -1233,7 +2962,7 @@ L expand(L x,L e,L b) {
     /* <lambda> arguments v hide macro variables in b and hide global primitives and macros in e */
     v = car(x); w = hygienic(v,cdr(x));
     *p = cons(w,nil);
-    for (d = dup(e),c = dup(b); T(v) == CONS; v = CDR(v),w = CDR(w))
+    for (d = dupl(e),c = dupl(b); T(v) == CONS; v = CDR(v),w = CDR(w))
      if (T(CAR(v)) == ATOM) d = pair(CAR(v),nil,d),c = pair(CAR(v),CAR(w),c);
     if (T(v) == ATOM) d = pair(v,nil,d),c = pair(v,w,c);
     CDR(*p) = cons(expand(opt(x),d,c),nil);             /* expand <lambda> body */
@@ -1252,7 +2981,7 @@ L expand(L x,L e,L b) {
    }
    if (equ(f,p_leta)) {
     /* <let*> local variables hide macro variables in b and hide global primitives and macros in e */
-    for (d = dup(e),c = dup(b); let(x); x = CDR(x)) {
+    for (d = dupl(e),c = dupl(b); let(x); x = CDR(x)) {
      v = car(CAR(x)); w = hygienic(v,CDR(x));
      p = &CDR(*p = cons(cons(w,cons(expand(opt(CAR(x)),d,c),nil)),nil));
      if (T(v) == ATOM) d = pair(v,nil,d),c = pair(v,w,c);
@@ -1263,7 +2992,7 @@ L expand(L x,L e,L b) {
    }
    if (equ(f,p_let)) {
     /* <let> local variables hide macro variables in b and hide global primitives and macros in e */
-    for (d = dup(e),c = dup(b); let(x); x = CDR(x)) {
+    for (d = dupl(e),c = dupl(b); let(x); x = CDR(x)) {
      v = car(CAR(x)); w = hygienic(v,CDR(x));
      p = &CDR(*p = cons(cons(w,cons(expand(opt(CAR(x)),e,c),nil)),nil));
      if (T(v) == ATOM) d = pair(v,nil,d),c = pair(v,w,c);
@@ -1274,7 +3003,7 @@ L expand(L x,L e,L b) {
    }
    if (equ(f,p_letreca)) {
     /* <letrec*> local variables hide macro variables in b and hide global primitives and macros in e */
-    for (d = dup(e),c = dup(b); let(x); x = CDR(x)) {
+    for (d = dupl(e),c = dupl(b); let(x); x = CDR(x)) {
      v = car(CAR(x)); w = hygienic(v,x);
      if (T(v) == ATOM) d = pair(v,nil,d),c = pair(v,w,c);
      p = &CDR(*p = cons(cons(w,cons(expand(opt(CAR(x)),d,c),nil)),nil));
@@ -1285,7 +3014,7 @@ L expand(L x,L e,L b) {
    }
    if (equ(f,p_letrec)) {
     /* <letrec> local variables hide macro variables in b and hide global primitives and macros in e */
-    for (d = dup(e),c = dup(b),y = x; let(y); y = CDR(y)) {
+    for (d = dupl(e),c = dupl(b),y = x; let(y); y = CDR(y)) {
      v = car(CAR(y)); w = hygienic(v,x);
      if (T(v) == ATOM) d = pair(v,nil,d),c = pair(v,w,c);
     }
@@ -1304,14 +3033,14 @@ L expand(L x,L e,L b) {
     x = opt(x);                                         /* body x of (<define> v x) */
     if (T(v) == ATOM) {                                 /* if v is an atom then ... */
      f = closure(nil,nil,nil);                          /* v may reference itself, assume it's a function */
-     d = pair(v,f,dup(e));                              /* update environment d of e to include (v . f) */
+     d = pair(v,f,dupl(e));                              /* update environment d of e to include (v . f) */
      rc(&y,expand(x,d,b));                              /* y is expanded body x of (<define> v x) */
      if (ref[ord(f)/2] > 1) {                           /* if v references itself in y then ... */
       z = eval(y,e);                                    /* evaluate expanded y of body x */
       if (T(z) == CLOS) {                               /* if this is a closure then ... */
        gc(CAR(f));
-       CAR(f) = dup(CAR(z));                            /* replace the variables and body of closure f with z's */
-       CDR(f) = dup(CDR(z));                            /* replace the environment of closure f with z's */
+       CAR(f) = dupl(CAR(z));                            /* replace the variables and body of closure f with z's */
+       CDR(f) = dupl(CDR(z));                            /* replace the environment of closure f with z's */
        gc(z);                                           /* delete duplicate closure z of f */
        CDR(*p) = cons(f,nil);                           /* to return expanded (<define> v f) with closure f */
       }
@@ -1320,7 +3049,7 @@ L expand(L x,L e,L b) {
        return err(2,v);
       }
      }
-     else CDR(*p) = cons(dup(y),nil);                   /* to return expanded (<define> v y) */
+     else CDR(*p) = cons(dupl(y),nil);                   /* to return expanded (<define> v y) */
      rg(1);
     }
     else CDR(*p) = cons(expand(x,e,b),nil);             /* to return expanded (<define> v y) */
@@ -1335,37 +3064,185 @@ L expand(L x,L e,L b) {
   return t;
  }
  rr(2);
- return dup(x);
+ return dupl(x);
 }
 
-/* section 8: printing Lisp expressions */
-void printlist(FILE *f,L t) {
- fputc('(',f);
+/* section 8: printing Lisp expressions ++ updated: buffered output with fast number formatting */
+/* DIGITS: print numbers with %.<DIGITS>lg, e.g. -DDIGITS=10 for the old format, otherwise (DIGITS=0 by default) print
+   numbers with the shortest representation that reads back exactly as the same number */
+#ifndef DIGITS
+#define DIGITS 0
+#endif
+/* integer numbers n with -LIM < n < LIM are printed fast without printf, i.e. up to 16 digits or up to DIGITS digits ++
+   updated: all integers within 2^53 are printed with all of their digits like bignums */
+#if DIGITS
+#define CAT(a,b) a##b
+#define POW10(k) CAT(1e,k)
+#define LIM POW10(DIGITS)
+#else
+#define LIM 1e16
+#endif
+/* output buffer ob[] holds on chars to write to file of, written in large blocks with flush() */
+void flush() { fwrite(ob,1,on,of); on = 0; }
+void emit(const char *s,I k) {
+ if (on+k > sizeof(ob)) flush();
+ if (k > sizeof(ob)) fwrite(s,1,k,of); else memcpy(ob+on,s,k),on += k;
+}
+void put(char c) { if (on >= sizeof(ob)) flush(); ob[on++] = c; }
+/* ++ new: Grisu3 shortest digits of numbers, see F. Loitsch "Printing Floating-Point Numbers Quickly and Accurately with
+   Integers", PLDI 2010, uses cached powers of ten 10^k = pf[K+k]*2^pe[K+k] for -K <= k <= 330 with 64 bit significands */
+#define K 310
+uint64_t pf[K+331]; int pe[K+331];
+/* return the 64 bit significand of bignum b[0..j-1] with 32 bit limbs rounded to nearest, set *e for b*2^s = result*2^*e */
+uint64_t top(uint32_t *b,int j,int s,int *e) {
+ int i,k = 32*j; uint64_t f = 0;
+ while (!(b[(k-1)/32]>>(k-1)%32&1)) --k;                /* k is the number of bits of b */
+ for (i = k-1; i >= 0 && i >= k-64; --i) f = f<<1|(b[i/32]>>i%32&1);
+ if (k < 64) f <<= 64-k;
+ *e = s+k-64;
+ if (k > 64 && b[(k-65)/32]>>(k-65)%32&1 && !++f) f = (uint64_t)1<<63,++*e;
+ return f;
+}
+/* populate pf[] and pe[] with 10^k = b for k >= 0 and with 10^k = b*2^-1344 for k < 0 where b = 2^1344/10^-k */
+void pows() {
+ uint32_t b[43]; uint64_t r; int i,j,k;
+ memset(b,0,sizeof(b));
+ for (b[0] = 1,j = 1,k = 0; k <= 330; ++k) {
+  pf[K+k] = top(b,j,0,&pe[K+k]);
+  for (r = 0,i = 0; i < j; ++i) r += (uint64_t)b[i]*10,b[i] = r,r >>= 32;
+  if (r) b[j++] = r;
+ }
+ memset(b,0,sizeof(b));
+ for (b[42] = 1,k = 1; k <= K; ++k) {
+  for (r = 0,i = 42; i >= 0; --i) r = r<<32|b[i],b[i] = r/10,r %= 10;
+  pf[K-k] = top(b,43,-1344,&pe[K-k]);
+ }
+}
+/* return the high 64 bits of the 128 bit product of x and y, rounded */
+uint64_t mulhi(uint64_t x,uint64_t y) {
+ uint64_t a = x>>32,b = x&0xffffffff,c = y>>32,d = y&0xffffffff,m = (b*d>>32)+(a*d&0xffffffff)+(b*c&0xffffffff)+(1U<<31);
+ return a*c+(a*d>>32)+(b*c>>32)+(m>>32);
+}
+/* round the last digit of d[0..m-1] towards w, return nonzero when the digits are guaranteed the shortest and closest */
+int weed(char *d,int m,uint64_t w,uint64_t u,uint64_t r,uint64_t t,uint64_t unit) {
+ uint64_t lo = w-unit,hi = w+unit;
+ while (r < lo && u-r >= t && (r+t < lo || lo-r >= r+t-lo)) --d[m-1],r += t;
+ if (r < hi && u-r >= t && (r+t < hi || hi-r > r+t-hi)) return 0;
+ return 2*unit <= r && r <= u-4*unit;
+}
+/* set d[] to the shortest digits of number n > 0 and *x to the exponent of n = d*10^*x, returns number of digits or 0 */
+int grisu(L n,char *d,int *x) {
+ union { L x; uint64_t i; } v = {n};
+ uint64_t f = v.i&(((uint64_t)1<<52)-1),w,hi,lo,one,p,q,t,u,unit = 1; int e = v.i>>52&0x7ff,we,le,k,m = 0;
+ if (!pe[0]) pows();
+ if (e) f |= (uint64_t)1<<52,e -= 1075; else e = -1074;
+ hi = 2*f+1;                                            /* upper boundary (2f+1)*2^(e-1) of n */
+ if (f == (uint64_t)1<<52 && e > -1074) lo = 4*f-1,le = e-2; else lo = 2*f-1,le = e-1;        /* lower boundary */
+ for (we = e-1; !(hi>>63); --we) hi <<= 1;
+ for (lo <<= le-we,w = f; !(w>>63); --e) w <<= 1;       /* normalized n and its boundaries have the same exponent */
+ for (k = ceil((-61-we)*0.30102999566398120); we+pe[K+k]+64 < -60; ++k) continue;
+ while (we+pe[K+k]+64 > -32) --k;
+ e = -(we+pe[K+k]+64);                                  /* scale n and its boundaries by 10^k to binary exponent -e */
+ w = mulhi(w,pf[K+k]); hi = mulhi(hi,pf[K+k])+unit; lo = mulhi(lo,pf[K+k])-unit;
+ u = hi-lo; one = (uint64_t)1<<e; p = hi>>e; q = hi&(one-1);
+ for (t = 1; t <= p/10; t *= 10) ++m;                   /* t = largest power of ten <= integral part p */
+ for (*x = m+1-k,m = 0; t; t /= 10) {                   /* generate the integral digits */
+  d[m++] = '0'+p/t; p %= t; --*x;
+  if ((p<<e)+q < u) return weed(d,m,hi-w,u,(p<<e)+q,t<<e,unit) ? m : 0;
+ }
+ while (1) {                                            /* generate the fractional digits */
+  q *= 10; unit *= 10; u *= 10;
+  d[m++] = '0'+(q>>e); q &= one-1; --*x;
+  if (q < u) return weed(d,m,(hi-w)*unit,u,q,one,unit) ? m : 0;
+ }
+}
+/* ++ new: format number n in s[] (at least 32 chars), fast for integers, returns the length of the string */
+I fmt(char *s,L n) {
+ I i = DIGITS ? DIGITS : 15,k; int j,x; char d[20],*p = d+sizeof(d);
+ if (n > -LIM && n < LIM && n == (int64_t)n && (n != 0 || !signbit(n))) {
+  int64_t j = n < 0 ? -n : n;
+  do *--p = '0'+j%10; while (j /= 10);
+  if (n < 0) *--p = '-';
+  for (k = 0; p < d+sizeof(d); ++k) s[k] = *p++;
+  return s[k] = 0,k;
+ }
+ if (!DIGITS && n != 0 && n-n == 0 && (j = grisu(fabs(n),d,&x))) {
+  /* format the shortest digits d[0..j-1] with exponent x like %.15lg or wider when more than 15 digits are needed */
+  for (; j > 1 && d[j-1] == '0'; --j) ++x;
+  k = 0;
+  if (n < 0) s[k++] = '-';
+  if (x+j-1 < -4 || x+j-1 >= (j > 15 ? j : 15)) {
+   s[k++] = *d;
+   if (j > 1) s[k++] = '.';
+   for (i = 1; i < j; ++i) s[k++] = d[i];
+   return k+sprintf(s+k,"e%c%02d",x+j-1 < 0 ? '-' : '+',abs(x+j-1));
+  }
+  if (x+j <= 0) for (s[k++] = '0',s[k++] = '.',i = 0; i < -x-j; ++i) s[k++] = '0';
+  for (i = 0; i < j; ++i) {
+   s[k++] = d[i];
+   if (i+1 == x+j && i+1 < j) s[k++] = '.';
+  }
+  for (; x > 0; --x) s[k++] = '0';
+  return s[k] = 0,k;
+ }
+ /* shortest of 15, 16 or 17 significant digits that reads back as n, 15 is the smallest count worth trying, since any
+    decimal of up to 15 digits converts to a double and back unchanged, but a double may need 16 or 17 digits */
+ while ((k = snprintf(s,32,"%.*lg",i,n)) && !DIGITS && i < 17 && strtod(s,NULL) != n) ++i;
+ return k;
+}
+void show(L);
+void printlist(L t) {
+ put('(');
  while (1) {
-  print(f,CAR(t));
+  show(CAR(t));
   if (not(t = CDR(t))) break;
-  if (T(t) != CONS) { fprintf(f," . "); print(f,t); break; }
-  fputc(' ',f);
+  if (T(t) != CONS) { emit(" . ",3); show(t); break; }
+  put(' ');
  }
- fputc(')',f);
+ put(')');
 }
 /* ++ new: display closure or macro, with its name if in the global environment */
-void printpair(FILE *f,char c[2],L x) {
- L e = env;
+void printpair(char c[2],L x) {
+ L e = env; char s[32];
  while (T(e) == CONS && !equ(x,CDR(CAR(e)))) e = CDR(e);
- if (T(e) == CONS && T(CAR(CAR(e))) == ATOM) fprintf(f,"%c%s%c",c[0],A+ord(CAR(CAR(e))),c[1]);
- else fprintf(f,"%c%u%c",c[0],ord(x),c[1]);
-}
-void print(FILE *f,L x) {
- if (T(x) == NIL) fprintf(f,"()");
- else if (T(x) == ATOM) fprintf(f,"%s",A+ord(x));
- else if (T(x) == PRIM) fprintf(f,"<%s>",prim[ord(x)].s);
- else if (T(x) == CONS) printlist(f,x);
- else if (T(x) == CLOS) printpair(f,"{}",x);
- else if (T(x) == MACR) printpair(f,"[]",x);
- else if (T(x) == HOLD) fprintf(f,"|%s|",A+ord(x));
- else fprintf(f,"%.10lg",x);
+ put(c[0]);
+ if (T(e) == CONS && T(CAR(CAR(e))) == ATOM) emit(A+ord(CAR(CAR(e))),strlen(A+ord(CAR(CAR(e)))));
+ else emit(s,fmt(s,ord(x)));
+ put(c[1]);
+}
+void show(L x) {
+ char s[32];
+ if (T(x) == NIL) emit("()",2);
+ else if (T(x) == ATOM) emit(A+ord(x),strlen(A+ord(x)));
+ else if (T(x) == PRIM) put('<'),emit(prim[ord(x)].s,strlen(prim[ord(x)].s)),put('>');
+ else if (T(x) == CONS) printlist(x);
+ else if (T(x) == CLOS) printpair("{}",x);
+ else if (T(x) == MACR) printpair("[]",x);
+ else if (T(x) == HOLD) put('|'),emit(A+ord(x),strlen(A+ord(x))),put('|');
+ else if (T(x) == VECT) {                               /* ++ new: display vector #(x1 x2 ... xk) */
+  I i = ord(x),j;
+  emit("#(",2);
+  for (j = i+1; j <= i+VK(i); ++j) { if (j > i+1) put(' '); show(vec[j].x); }
+  put(')');
+ }
+ else if (T(x) == HASH) {                               /* ++ new: display hash table #hash((k1 . x1) ... (kn . xn)) */
+  I i = ord(vec[ord(x)+4].x),j,k = 0;
+  emit("#hash(",6);
+  for (j = i+1; j <= i+VK(i); j += 2)
+   if (T(vec[j].x) != NIL || !ord(vec[j].x)) {
+    if (k++) put(' ');
+    put('('); show(vec[j].x); emit(" . ",3); show(vec[j+1].x); put(')');
+   }
+  put(')');
+ }
+ else if (T(x) == STR) emit(txt(x),ord(vec[ord(x)+1].x));            /* ++ new: display string */
+ else if (T(x) == BIG) { char b[10*BN(ord(x))+2]; emit(b,bigfmt(b,x)); }         /* ++ new: display bignum */
+ else if (T(x) == FUT) emit("#<future>",9);                            /* ++ new: display future */
+ else if (T(x) == EVT) emit("#<event>",8);                             /* ++ new: display event */
+ else emit(s,fmt(s,x));
 }
+/* print x to file f, flushes the output buffer to f when done */
+void print(FILE *f,L x) { of = f; show(x); flush(); }
 
 /* ++ new: atomize (stringify) x to buffer a when not NULL, must be large enough to hold the string, return string length */
 I atomize(L x,char *a) {
@@ -1382,16 +3259,34 @@ I atomize(L x,char *a) {
   return k;
  }
  if (T(x) == ATOM || T(x) == HOLD) return strlen(a ? strcpy(a,A+ord(x)) : A+ord(x));
- if (x == x) snprintf(buf,sizeof(buf),"%.10lg",x); else strcpy(buf," ");
+ if (T(x) == STR) return strlen(a ? strcpy(a,txt(x)) : txt(x));
+ if (T(x) == BIG) { char b[10*BN(ord(x))+2]; I k = bigfmt(b,x); if (a) memcpy(a,b,k+1); return k; }
+ if (x == x) fmt(buf,x); else strcpy(buf," ");
  return strlen(a ? strcpy(a,buf) : buf);
 }
 
-/* section 10: read-eval-print loop (REPL) with additions */
-int main(int argc,char **argv) {
- I i; printf("tinylisp-extras-expand-gc");
+/* ++ new: initialize the tables shared by all instances before main() and threads start, if supported by the compiler */
+#ifdef __GNUC__
+__attribute__((constructor))
+#endif
+void tables() {
+ if (!pe[0]) pows(),vsimd();
+ if (!pk) while (strcmp(prim[pk].s,"escape/ec")) ++pk;
+}
+/* ++ new: the frozen template of new instances is saved to temporary file fzf, fzg is the number of templates frozen */
+FILE *fzf; I fzg;
+/* ++ new: create a new interpreter instance with a fresh global environment, returns NULL when out of memory */
+struct lisp *fresh() {
+ I i; struct lisp *c = calloc(1,sizeof(struct lisp)),*o = cx;
+ if (!c) return NULL;
+ tables();
+ cx = c;
+ fp = lp = N-2; fn = N/2; ep = 1; sp = xp = stk; ptr = ""; out = stdout; fz = N; hv = ev = nil;
  sweep(); /* sweep all cells to the free list (since all ref[] are zero) */
  atom("ERR"); atom("#t"); env = pair(tru,tru,nil);
+ pthread_mutex_lock(&pm);
  for (i = 0; prim[i].s; ++i) env = pair(atom(prim[i].s),box(PRIM,i),env);
+ pthread_mutex_unlock(&pm);
  /* section 17.1: early binding and efficient macro expansion */
  p_quote   = assoc(atom("quote"),env);
  p_lambda  = assoc(atom("lambda"),env);
@@ -1402,23 +3297,295 @@ int main(int argc,char **argv) {
  p_letreca = assoc(atom("letrec*"),env);
  p_letrec  = assoc(atom("letrec"),env);
  p_define  = assoc(atom("define"),env);
+ cx = o;
+ return c;
+}
+/* ++ new: create a new interpreter instance, a copy-on-write mapping of the frozen template or else a fresh instance,
+   returns NULL when out of memory */
+API struct lisp *newlisp() {
+ struct lisp *c,*o = cx;
+ if (!fzf) return fresh();
+ c = mmap(NULL,sizeof(struct lisp),PROT_READ|PROT_WRITE,MAP_PRIVATE,fileno(fzf),0);
+ if (c == MAP_FAILED) return NULL;
+ cx = c; mm = 1; sp = xp = stk; cx = o;
+ return c;
+}
+/* ++ new: freeze a copy of the global environment of instance c as the template of new instances, the instances share the
+   frozen cell pairs, blocks and atoms of the template without ref counting them and they cannot be updated, a definition
+   shadows a frozen definition, returns zero when failed */
+API int freezelisp(struct lisp *c) {
+ struct lisp *o = cx,*t = fresh(); struct memo m = {0}; FILE *f = tmpfile(); L x; I i; int ok = 0; jmp_buf b;
+ if (t && f) {
+  cx = c; x = env; cx = t; jb = &b;
+  if (!setjmp(b)) {
+   from(&m,c,0); m.b = m.ph;
+   atoms(&m);
+   gc(env); env = nil; m.u = 1; copy(&m,x,&env);        /* the copy takes the top cell pairs and the bottom blocks */
+   memset(ref,0,sizeof(ref));
+   for (i = 0; i < vp; i += VK(i)+1) if (VR(i) != FREE) VR(i) = 0;
+   count(env);
+   fz = lp; fv = vp; fh = hp; fg = ++fzg;
+   for (i = fz; i < N; i += 2) ref[i/2] = 2;     /* frozen pairs and blocks are shared */
+   for (i = 0; i < fv; i += VK(i)+1) if (VR(i) != FREE) VR(i) = 2;
+   sweep();
+   jb = NULL;                                   /* the instances set their own handler */
+   ok = fwrite(t,sizeof(struct lisp),1,f) == 1 && !fflush(f);
+  }
+ }
+ free(m.t); free(t);
+ cx = o;
+ if (!ok) { if (f) fclose(f); return 0; }
+ if (fzf) fclose(fzf);                          /* the instances mapping the old template keep it */
+ fzf = f;
+ return 1;
+}
+/* ++ new: make instance c current in this thread, returns c */
+API struct lisp *uselisp(struct lisp *c) { return cx = c; }
+/* ++ new: delete instance c, closes its open load files */
+API void freelisp(struct lisp *c) {
+ struct lisp *o = cx; I k;
+ cx = c;
+ while (ld) if (in[--ld]) fclose(in[ld]);
+ if (ef) close(ef-1);
+ k = mm;
+ cx = o == c ? NULL : o;
+ if (k) munmap(c,sizeof(struct lisp)); else free(c);
+}
+
+/* ++ new: evaluate the expressions in string s with instance c, returns a new malloc'ed string with the output and the
+   printed value of each expression on a separate line like batch mode, returns NULL when out of memory */
+API char *evalstr(struct lisp *c,const char *s) {
+ struct lisp *o = cx; FILE *f,*fo; char *r = NULL,*po,so,bo; size_t k; I i = 0; jmp_buf b,*jo;
+ if (!(f = open_memstream(&r,&k))) return NULL;
+ cx = c;
+ fo = out; po = ptr; so = see; bo = batch;
+ out = f; ptr = (char*)s; see = ' '; batch = 2;
+ jo = jb; jb = &b;
+ if ((i = setjmp(b)) > 0) {
+  if (ld) see = ' ';                            /* continue with the string after an error in a loaded file */
+  while (ld) if (in[--ld]) fclose(in[ld]);
+  fprintf(out,"ERR %u\n",i);
+  if (i == 7) see = 0,ptr = "";                 /* skip the rest of the string after a syntax error */
+  rg(sp-xp);                    /* deregister and garbage collect "lost" variables */
+ }
+ while (1) {
+  L x,y,z;
+  if (i || dt || 2*fn-hp/8 < N/4) rebuild(),i = 0;
+  while ((see || ld) && (seeing(' ') || seeing(';'))) if (get() == ';') while (!seeing('\n')) get();
+  if (!see && !ld) break;
+  print(out,rc(&z,eval(rc(&y,expand(rc(&x,Read()),env,nil)),env)));
+  putc('\n',out);
+  rg(3);
+ }
+ jb = jo;
+ out = fo; ptr = po; see = so; batch = bo;
+ cx = o;
+ fclose(f);
+ return r;
+}
+
+/* ++ new: C API, the values returned by evallisp(), calllisp(), strlisp() and listlisp() are held by the instance in its
+   list hv, so they are not collected until released with droplisp(), the saved state of a call is kept in a struct save */
+struct save { struct lisp *c; L **p,**q; char b; jmp_buf j,*k; struct esc *e; };
+/* switch to instance c in C API mode, errors throw to the API function and do not unwind the caller's stack frames */
+void enter(struct save *s,struct lisp *c) {
+ s->c = cx; cx = c;
+ if (sp == stk && (dt || 2*fn-hp/8 < N/4)) rebuild();  /* rebuild only when not called by a primitive */
+ s->p = sp; s->q = xp; s->b = batch; xp = sp; batch = 3;
+ s->k = jb; jb = &s->j;
+ s->e = es; es = NULL;                          /* a continuation cannot escape from a C API call */
+}
+/* switch back from C API mode after error i, or no error when i is zero, returns i */
+int leave(struct save *s,int i) {
+ if (i) while (ld) if (in[--ld]) fclose(in[ld]);
+ if (i) ++dt;                                   /* unregistered cells lost by the error are collected by rebuild() */
+ jb = s->k; es = s->e;
+ sp = s->p; xp = s->q; batch = s->b; cx = s->c;
+ return i;
+}
+/* hold value x registered with rc(), returns x */
+L hold1(L x) { hv = cons(x,hv); rr(1); return x; }
+/* evaluate the expressions in the n chars of buffer s with instance c, returns the value of the last expression or ()
+   when s is empty, sets *e to the error code when not NULL, which is zero when no error occurred */
+API L evallisp(struct lisp *c,const char *s,size_t n,int *e) {
+ struct save v; char *q = malloc(n+1),*po,so; L x,y,z = nil; int i;
+ if (!q) { if (e) *e = 4; return nil; }
+ memcpy(q,s,n); q[n] = '\0';
+ enter(&v,c);
+ po = ptr; so = see; ptr = q; see = ' ';
+ if (!(i = setjmp(*jb))) {
+  rc(&z,nil);
+  while (1) {
+   while ((see || ld) && (seeing(' ') || seeing(';'))) if (get() == ';') while (!seeing('\n')) get();
+   if (!see && !ld) break;
+   gc(z); z = nil;
+   z = eval(rc(&y,expand(rc(&x,Read()),env,nil)),env);
+   rg(2);
+  }
+  hold1(z);
+ }
+ ptr = po; see = so;
+ free(q);
+ if (e) *e = leave(&v,i);
+ return i ? nil : z;
+}
+/* call the global function named f with instance c and k arguments x[0] to x[k-1], returns the value, sets *e to the
+   error code when not NULL, which is zero when no error occurred */
+API L calllisp(struct lisp *c,const char *f,int k,L *x,int *e) {
+ struct save v; L y = nil; int i;
+ enter(&v,c);
+ if (!(i = setjmp(*jb))) hold1(rc(&y,apply(assoc(atom(f),env),k,x,env)));
+ if (e) *e = leave(&v,i);
+ return i ? nil : y;
+}
+/* return a new string with the chars of s, or () when out of memory */
+API L strlisp(struct lisp *c,const char *s) {
+ struct save v; L y = nil; int i;
+ enter(&v,c);
+ if (!(i = setjmp(*jb))) hold1(rc(&y,string(s,strlen(s))));
+ leave(&v,i);
+ return i ? nil : y;
+}
+/* return a new list of k values x[0] to x[k-1], or () when out of memory */
+API L listlisp(struct lisp *c,int k,L *x) {
+ struct save v; L y = nil; int i;
+ enter(&v,c);
+ if (!(i = setjmp(*jb))) {
+  rc(&y,nil);
+  while (k > 0) y = cons(dupl(x[--k]),y);
+  hold1(y);
+ }
+ leave(&v,i);
+ return i ? nil : y;
+}
+/* release value x held by instance c */
+API void droplisp(struct lisp *c,L x) {
+ struct lisp *o = cx; L *p,q;
+ cx = c;
+ for (p = &hv; T(*p) == CONS && !equ(CAR(*p),x); p = &CDR(*p)) continue;
+ if (T(*p) == CONS) q = *p,*p = CDR(q),CDR(q) = nil,gc(q);
+ cx = o;
+}
+/* return the car or cdr of pair x of instance c or the current instance when c is NULL, or () when x is not a pair, the
+   value is held by x */
+API L carlisp(struct lisp *c,L x) { struct lisp *o = cx; if (c) cx = c; x = T(x) == CONS ? CAR(x) : nil; cx = o; return x; }
+API L cdrlisp(struct lisp *c,L x) { struct lisp *o = cx; if (c) cx = c; x = T(x) == CONS ? CDR(x) : nil; cx = o; return x; }
+/* return the type of x like (type x) and 10 for a bignum, the value of a number of type 0 is x */
+API int typelisp(L x) { return T(x) == BIG ? 10 : type(x); }
+/* return the text of atom or string x of instance c or the current instance when c is NULL, or NULL when x is not an
+   atom or a string */
+API const char *textlisp(struct lisp *c,L x) { struct lisp *o = cx; char *s; if (c) cx = c; s = txt(cede(x)); cx = o; return s; }
+/* return a new malloc'ed string with x of instance c or the current instance when c is NULL printed, or NULL when out of
+   memory */
+API char *showlisp(struct lisp *c,L x) {
+ struct lisp *o = cx; FILE *f; char *r = NULL; size_t k;
+ if (!(f = open_memstream(&r,&k))) return NULL;
+ if (c) cx = c;
+ print(f,x);
+ cx = o;
+ fclose(f);
+ return r;
+}
+/* add primitive s with C function f and tail-call flag t to prim[] and define it in instance c when c is not NULL, the
+   instances created after it define it too, returns the index of the primitive in prim[] or -1 when prim[] is full */
+API int primlisp(struct lisp *c,const char *s,L (*f)(L,L*),int t) {
+ struct save v; int i; char *q;
+ pthread_mutex_lock(&pm);
+ for (i = 0; prim[i].s && (strcmp(prim[i].s,s) || prim[i].f != f || prim[i].t != t); ++i) continue;
+ if (!prim[i].s) {
+  if (i < P-1 && (q = strdup(s))) prim[i].f = f,prim[i].t = t,prim[i].s = q;
+  else i = -1;
+ }
+ pthread_mutex_unlock(&pm);
+ if (i < 0 || !c) return i;
+ enter(&v,c);
+ if (!setjmp(*jb)) env = pair(atom(s),box(PRIM,i),env),++dn;
+ else i = -1;
+ leave(&v,i < 0);
+ return i;
+}
+/* a primitive f(t,e) added with primlisp() evaluates the arguments in list t with arglisp(&t,e,&a) in environment *e,
+   where a is a zero-initialized dot argument flag, and returns a new value, these functions are exported instead of
+   evarg(), dupl(), gc(), cons(), err(), atom() and string() that clash with names in libc */
+API L arglisp(L *t,L *e,I *a) { return evarg(t,e,a); }
+API L duplisp(L x) { return dupl(x); }
+API L gclisp(L x) { return gc(x); }
+API L conslisp(L x,L y) { return cons(x,y); }
+API L errlisp(int i,L x) { return err(i,x); }
+API L atomlisp(const char *s) { return atom(s); }
+API L stringlisp(const char *s,size_t k) { return string(s,k); }
+
+/* section 10: read-eval-print loop (REPL) with additions */
+/* ++ new: compile with -DLIB to use tinylisp as a library without main() */
+#ifndef LIB
+/* ++ new: prefork worker process serving the connections to socket s, each connection sends Lisp text and receives the
+   output of its evaluation by a new instance, which is a copy-on-write mapping of the frozen template */
+void serve(int s) {
+ char *b = NULL,*r; size_t n,z = 0; ssize_t k; int c;
+ signal(SIGPIPE,SIG_IGN);
+ while ((c = accept(s,NULL,NULL)) >= 0) {
+  struct lisp *w = newlisp();
+  for (n = 0; (b = n+1 < z ? b : realloc(b,z = 2*z+4096)) && (k = read(c,b+n,z-n-1)) > 0; n += k) continue;
+  if (b) b[n] = '\0';
+  r = w && b ? evalstr(w,b) : NULL;
+  for (n = 0,z = r ? strlen(r) : 0; n < z && (k = write(c,r+n,z-n)) > 0; n += k) continue;
+  if (!r) k = write(c,"ERR 4\n",6);
+  free(r); if (w) freelisp(w);
+  close(c);
+ }
+ exit(EXIT_FAILURE);
+}
+/* ++ new: tinylisp --prefork N socket [file] loads the file, common.lisp by default, once and freezes it, then forks N
+   worker processes that serve the connections to the Unix domain socket, restarts workers that exit */
+int prefork(int n,const char *path,const char *file) {
+ struct sockaddr_un a; int s,i; char *q = malloc(strlen(file)+10);
+ if (!q) return EXIT_FAILURE;
+ sprintf(q,"(load %s)\n",file);
+ free(evalstr(cx,q)); free(q);
+ if (!freezelisp(cx)) return EXIT_FAILURE;
+ memset(&a,0,sizeof(a)); a.sun_family = AF_UNIX; strncpy(a.sun_path,path,sizeof(a.sun_path)-1);
+ unlink(path);
+ if ((s = socket(AF_UNIX,SOCK_STREAM,0)) < 0 || bind(s,(struct sockaddr*)&a,sizeof(a)) || listen(s,128)) {
+  perror(path);
+  return EXIT_FAILURE;
+ }
+ fflush(stdout);
+ for (i = 0; i < n; ++i) if (!fork()) serve(s);
+ while (wait(NULL) > 0) if (!fork()) serve(s);
+ return EXIT_SUCCESS;
+}
+/* ++ new: tinylisp --batch [file] evaluates Lisp from stdin without prompts, history and REPL rebuild() unless needed */
+int main(int argc,char **argv) {
+ I i; jmp_buf b;
+ if (!uselisp(newlisp())) return EXIT_FAILURE;
+ if (argc > 3 && !strcmp(argv[1],"--prefork")) return prefork(atoi(argv[2]),argv[3],argc > 4 ? argv[4] : "common.lisp");
+ if (argc > 1 && !strcmp(argv[1],"--batch")) {
+  batch = 1; --argc; ++argv;
+  setvbuf(stdin,NULL,_IOFBF,65536);             /* read stdin and write stdout in large blocks */
+  setvbuf(stdout,NULL,_IOFBF,65536);
+ }
+ else printf("tinylisp-extras-expand-gc");
  /* read input file */
  in[ld++] = fopen((argc > 1 ? argv[1] : "common.lisp"),"r");
  using_history();
  signal(SIGINT,stop);
- if ((i = setjmp(jb)) > 0) {
+ jb = &b;
+ if ((i = setjmp(b)) > 0) {
   while (ld) if (in[--ld]) fclose(in[ld]);
-  printf("ERR %u",i);
+  printf(batch ? "ERR %u\n" : "ERR %u",i);
   if (i == 7) see = 0;
   rg(sp-xp);                    /* deregister and garbage collect "lost" variables */
  }
  out = stdout;
  while (1) {
   L x,y,z;
-  rebuild();
-  putchar('\n'); snprintf(ps,sizeof(ps),PS1,2*fn-hp/8);
+  /* ++ updated: rebuild() only after an error, after updates that may leave cyclic garbage, or when memory runs low */
+  if (i || dt || 2*fn-hp/8 < N/4) rebuild(),i = 0;
+  if (!batch) putchar('\n'),snprintf(ps,sizeof(ps),PS1,2*fn-hp/8);
   /* section 17.1: early binding and efficient macro expansion (REEPL = REPL with expand) */
   print(out,rc(&z,eval(rc(&y,expand(rc(&x,Read()),env,nil)),env)));
+  if (batch) putchar('\n');
   rg(3);
  }
 }
+#endif
@@ -0,0 +1,191 @@
+/* tinylisp-pool.c thread pool to evaluate Lisp in parallel with tinylisp-extras-expand-gc interpreter instances */
+
+/* compile with tinylisp-extras-expand-gc.c as a library:
+   cc -O2 -DLIB -c tinylisp-extras-expand-gc.c
+   cc -O2 -o tinylisp-pool tinylisp-pool.c tinylisp-extras-expand-gc.o -lreadline -lm -lpthread -ldl */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <unistd.h>
+#include "tinylisp.h"
+
+/* a job evaluates the Lisp expressions in string src, res is the output of the evaluation when done is set */
+struct job { char *src,*res; atomic_int done; };
+
+/* bounded lock-free multi-producer multi-consumer queue of Q jobs by D. Vyukov, Q must be a power of two:
+   the slot at position k is free to enqueue a job when its seq equals k and holds a job when its seq equals k+1 */
+#define Q 1024
+struct slot { atomic_size_t seq; struct job *job; };
+
+/* a pool of n worker threads t[n], each worker runs its own interpreter instance that first evaluates init when init
+   could not be frozen:
+   q[Q]:  the job queue with enqueue position tail and dequeue position head on separate cache lines
+   items: the number of queued jobs, idle workers sleep on the semaphore
+   m,c:   signal completed jobs to threads waiting for a result */
+struct pool {
+ struct slot q[Q];
+ _Alignas(64) atomic_size_t tail;
+ _Alignas(64) atomic_size_t head;
+ sem_t items;
+ pthread_mutex_t m; pthread_cond_t c;
+ int n; pthread_t *t; char *init;
+};
+
+/* enqueue job j, returns zero when the queue is full */
+int enq(struct pool *p,struct job *j) {
+ size_t k = atomic_load_explicit(&p->tail,memory_order_relaxed);
+ while (1) {
+  struct slot *s = &p->q[k & (Q-1)];
+  intptr_t d = (intptr_t)atomic_load_explicit(&s->seq,memory_order_acquire)-(intptr_t)k;
+  if (d < 0) return 0;
+  if (d > 0) k = atomic_load_explicit(&p->tail,memory_order_relaxed);
+  else if (atomic_compare_exchange_weak_explicit(&p->tail,&k,k+1,memory_order_relaxed,memory_order_relaxed)) {
+   s->job = j;
+   atomic_store_explicit(&s->seq,k+1,memory_order_release);
+   return 1;
+  }
+ }
+}
+
+/* dequeue a job, returns NULL when the queue is empty */
+struct job *deq(struct pool *p) {
+ size_t k = atomic_load_explicit(&p->head,memory_order_relaxed);
+ while (1) {
+  struct slot *s = &p->q[k & (Q-1)];
+  intptr_t d = (intptr_t)atomic_load_explicit(&s->seq,memory_order_acquire)-(intptr_t)(k+1);
+  if (d < 0) return NULL;
+  if (d > 0) k = atomic_load_explicit(&p->head,memory_order_relaxed);
+  else if (atomic_compare_exchange_weak_explicit(&p->head,&k,k+1,memory_order_relaxed,memory_order_relaxed)) {
+   struct job *j = s->job;
+   atomic_store_explicit(&s->seq,k+Q,memory_order_release);
+   return j;
+  }
+ }
+}
+
+/* worker thread with its own interpreter instance, runs jobs until it gets a job without src */
+void *work(void *a) {
+ struct pool *p = a; struct lisp *c = newlisp(); struct job *j;
+ if (c && p->init) free(evalstr(c,p->init));
+ while (1) {
+  while (sem_wait(&p->items)) continue;
+  while (!(j = deq(p))) sched_yield();          /* a job was counted but its enq() is not yet complete */
+  if (!j->src) break;
+  j->res = c ? evalstr(c,j->src) : NULL;
+  pthread_mutex_lock(&p->m);
+  atomic_store(&j->done,1);
+  pthread_cond_broadcast(&p->c);
+  pthread_mutex_unlock(&p->m);
+ }
+ free(j);
+ if (c) freelisp(c);
+ return NULL;
+}
+
+/* queue job j, waits while the queue is full */
+void queue(struct pool *p,struct job *j) {
+ while (!enq(p,j)) sched_yield();
+ sem_post(&p->items);
+}
+
+/* create a pool of n worker threads (n = 0 for one per core) that first evaluate init when not NULL, init is evaluated
+   once and frozen as the template of the worker instances, which share its global environment */
+struct pool *newpool(int n,const char *init) {
+ struct pool *p = calloc(1,sizeof(struct pool)); struct lisp *c; size_t k;
+ if (!p) return NULL;
+ if (n <= 0) n = sysconf(_SC_NPROCESSORS_ONLN);
+ if (n <= 0) n = 1;
+ for (k = 0; k < Q; ++k) atomic_init(&p->q[k].seq,k);
+ sem_init(&p->items,0,0);
+ pthread_mutex_init(&p->m,NULL);
+ pthread_cond_init(&p->c,NULL);
+ p->init = init ? strdup(init) : NULL;
+ if (p->init && (c = newlisp())) {
+  free(evalstr(c,p->init));
+  if (freezelisp(c)) { free(p->init); p->init = NULL; }
+  freelisp(c);
+ }
+ p->t = malloc(n*sizeof(pthread_t));
+ for (p->n = 0; p->t && p->n < n && !pthread_create(&p->t[p->n],NULL,work,p); ++p->n) continue;
+ return p;
+}
+
+/* submit a copy of string s with Lisp expressions to evaluate by a worker, returns the job or NULL */
+struct job *submit(struct pool *p,const char *s) {
+ struct job *j = calloc(1,sizeof(struct job));
+ if (!j) return NULL;
+ if (!(j->src = strdup(s))) { free(j); return NULL; }
+ queue(p,j);
+ return j;
+}
+
+/* wait for job j to complete and delete it, returns the output as a malloc'ed string or NULL when out of memory */
+char *result(struct pool *p,struct job *j) {
+ char *r;
+ if (!atomic_load(&j->done)) {
+  pthread_mutex_lock(&p->m);
+  while (!atomic_load(&j->done)) pthread_cond_wait(&p->c,&p->m);
+  pthread_mutex_unlock(&p->m);
+ }
+ r = j->res;
+ free(j->src);
+ free(j);
+ return r;
+}
+
+/* stop the workers after the queued jobs are done and delete the pool */
+void freepool(struct pool *p) {
+ int i;
+ for (i = 0; i < p->n; ++i) {
+  struct job *j = calloc(1,sizeof(struct job));
+  if (j) queue(p,j);
+ }
+ for (i = 0; i < p->n; ++i) pthread_join(p->t[i],NULL);
+ sem_destroy(&p->items);
+ pthread_mutex_destroy(&p->m);
+ pthread_cond_destroy(&p->c);
+ free(p->init);
+ free(p->t);
+ free(p);
+}
+
+#ifndef LIB
+/* print the output of job j, or ERR 4 when out of memory */
+void output(struct pool *p,struct job *j) {
+ char *r = j ? result(p,j) : NULL;
+ fputs(r ? r : "ERR 4\n",stdout);
+ free(r);
+}
+
+/* tinylisp-pool [-t threads] [-l file] ... evaluates each line of stdin as a job and prints the outputs of the jobs in
+   the order of the lines, each worker loads the files first, the number of threads is one per core by default */
+int main(int argc,char **argv) {
+ struct pool *p; struct job *w[Q]; char *s = NULL,*init = calloc(1,1); size_t k = 0,h = 0,t = 0; int n = 0,i;
+ for (i = 1; i < argc; ++i) {
+  if (!strcmp(argv[i],"-t") && i+1 < argc) n = atoi(argv[++i]);
+  else if (!strcmp(argv[i],"-l") && i+1 < argc && init) {
+   char *l = realloc(init,strlen(init)+strlen(argv[++i])+10);
+   if (l) sprintf(l+strlen(l),"(load %s)\n",argv[i]);    /* a new line, since load reads the file after the lookahead */
+   init = l;
+  }
+  else { fprintf(stderr,"usage: %s [-t threads] [-l file] ...\n",argv[0]); return EXIT_FAILURE; }
+ }
+ if (!init || !(p = newpool(n,init))) return EXIT_FAILURE;
+ free(init);
+ setvbuf(stdout,NULL,_IOFBF,65536);
+ while (getline(&s,&k,stdin) >= 0) {            /* keep up to Q jobs in flight, print outputs in order */
+  if (t-h == Q) output(p,w[h++ % Q]);
+  w[t++ % Q] = submit(p,s);
+ }
+ while (h < t) output(p,w[h++ % Q]);
+ free(s);
+ freepool(p);
+ return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,92 @@
+/* tinylisp.h C API of the tinylisp-extras-expand-gc.c interpreter compiled as a library with -DLIB */
+
+/* static library with only the C API functions exported:
+   cc -O2 -DLIB -fvisibility=hidden -c tinylisp-extras-expand-gc.c
+   objcopy --localize-hidden tinylisp-extras-expand-gc.o
+   ar rcs libtinylisp.a tinylisp-extras-expand-gc.o
+   cc -O2 -o app app.c libtinylisp.a -lreadline -lm -lpthread -ldl
+
+   shared library with only the C API functions exported:
+   cc -O2 -DLIB -fvisibility=hidden -fPIC -shared -o libtinylisp.so tinylisp-extras-expand-gc.c -lreadline -lm -lpthread -ldl
+   cc -O2 -o app app.c -L. -ltinylisp */
+
+#ifndef TINYLISP_H
+#define TINYLISP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* an interpreter instance, an instance must not be used by two threads at the same time */
+struct lisp;
+
+/* Lisp values are NaN-boxed doubles, a value of type 0 is a number and its value is the double itself, a value of another
+   type belongs to the instance that returned it, nil is the empty list () and tru is #t */
+static inline double nillisp(void) { union { uint64_t i; double x; } u = {(uint64_t)0x7ffd<<48}; return u.x; }
+static inline double trulisp(void) { union { uint64_t i; double x; } u = {(uint64_t)0x7ff8<<48|4}; return u.x; }
+
+/* create an instance, a copy-on-write clone of the frozen template if any, returns NULL when out of memory */
+struct lisp *newlisp(void);
+/* delete instance c */
+void freelisp(struct lisp *c);
+/* make instance c current in this thread, returns c */
+struct lisp *uselisp(struct lisp *c);
+/* freeze a copy of the global environment of instance c as the template of new instances, returns zero when failed */
+int freezelisp(struct lisp *c);
+
+/* evaluate the expressions in string s, returns a new malloc'ed string with the output and the printed value of each
+   expression on a separate line, returns NULL when out of memory */
+char *evalstr(struct lisp *c,const char *s);
+/* evaluate the expressions in the n chars of buffer s, returns the value of the last expression, sets *e to the error
+   code when e is not NULL, which is zero when no error occurred */
+double evallisp(struct lisp *c,const char *s,size_t n,int *e);
+/* call the global function named f with k arguments x[0] to x[k-1], returns the value, sets *e to the error code when e
+   is not NULL, which is zero when no error occurred */
+double calllisp(struct lisp *c,const char *f,int k,double *x,int *e);
+/* return a new string with the chars of s */
+double strlisp(struct lisp *c,const char *s);
+/* return a new list of k values x[0] to x[k-1] */
+double listlisp(struct lisp *c,int k,double *x);
+/* the values returned by evallisp(), calllisp(), strlisp() and listlisp() are held until released with droplisp() */
+void droplisp(struct lisp *c,double x);
+
+/* return the type of x, 0 = number, 1 = atom, 2 = primitive, 3 = pair, 4 = closure, 5 = macro, 6 = nil, 7 = vector,
+   8 = hash table, 9 = string, 10 = bignum, 11 = future, 12 = event */
+int typelisp(double x);
+/* return the car or cdr of pair x, or nil when x is not a pair, the value is valid while x is held, c is NULL to use the
+   current instance, e.g. in a primitive */
+double carlisp(struct lisp *c,double x);
+double cdrlisp(struct lisp *c,double x);
+/* return the text of atom or string x, or NULL when x is not an atom or a string, valid while x is held, c is NULL to use
+   the current instance */
+const char *textlisp(struct lisp *c,double x);
+/* return a new malloc'ed string with x printed, or NULL when out of memory, c is NULL to use the current instance */
+char *showlisp(struct lisp *c,double x);
+
+/* add primitive s with C function f and tail-call flag t, define it in instance c when c is not NULL and in the instances
+   created after it, returns the index of the primitive or -1 when the table of primitives is full */
+int primlisp(struct lisp *c,const char *s,double (*f)(double,double*),int t);
+/* a primitive f(t,e) evaluates the next argument in list t with arglisp(&t,e,&a) where a is initially zero, the values of
+   the arguments are released with gclisp(), the return value is a new value or, when the tail-call flag is set, an
+   expression to evaluate in environment *e, these functions use the current instance */
+double arglisp(double *t,double *e,uint32_t *a);
+double duplisp(double x);
+double gclisp(double x);
+double conslisp(double x,double y);
+double errlisp(int i,double x);
+double atomlisp(const char *s);
+double stringlisp(const char *s,size_t k);
+
+/* an extension is a shared object loaded with (load-extension "name.so") that defines the function initlisp(c), which
+   adds the primitives of the extension to instance c with primlisp() and returns zero when successful, the interpreter
+   is compiled with -fvisibility=hidden -rdynamic -ldl to export the C API to the extensions it loads */
+int initlisp(struct lisp *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -309,5 +309,192 @@
         'failed)
     '(set-cdr!))
 
+; vectors
+(cons
+    (if (letrec*
+            (v (make-vector 3 0))
+            (progn
+                (vector-set! v 1 5)
+                (and
+                    (equal? v (vector 0 5 0))
+                    (equal? (vector-ref v 1) 5)
+                    (equal? (vector-length v) 3)
+                    (equal? (vector->list (list->vector '(1 2 3))) '(1 2 3))
+                    (equal? (catch (vector-ref v 3)) '(ERR . 10)))))
+        'passed
+        'failed)
+    '(vectors))
+
+; hash tables with eq? and equal? keys
+(cons
+    (if (letrec*
+            (h (make-hash 1))
+            (g (make-hash))
+            (progn
+                (hash-set! h (list 'a 'b) 1)
+                (hash-set! h 'c 2)
+                (hash-set! g 'x 3)
+                (and
+                    (equal? (hash-ref h (list 'a 'b)) 1)
+                    (equal? (hash-ref h 'z 9) 9)
+                    (equal? (hash-count h) 2)
+                    (progn (hash-remove! h 'c) (equal? (hash-count h) 1))
+                    (equal? (hash->list h) '(((a b) . 1)))
+                    (equal? (hash-ref g 'x) 3))))
+        'passed
+        'failed)
+    '(hash tables))
+
+; strings
+(cons
+    (if (and
+            (string? (string-append "ab" "cd"))
+            (equal? (string-append "hello" " " "world") "hello world")
+            (equal? (substring "hello" 1 3) "el")
+            (equal? (string-length (string-append "ab" "c")) 3)
+            (eq? (string->symbol (string-append "a" "b")) 'ab))
+        'passed
+        'failed)
+    '(strings))
+
+; map, for-each, filter, foldl, foldr and sort
+(cons
+    (if (letrec*
+            (n 0)
+            (and
+                (equal? (map + '(1 2 3) '(10 20)) '(11 22))
+                (progn (for-each (lambda (x) (setq n (+ n x))) '(1 2 3)) (equal? n 6))
+                (equal? (filter (lambda (x) (< 1 x)) '(1 2 3)) '(2 3))
+                (equal? (foldl cons () '(1 2 3)) '(3 2 1))
+                (equal? (foldr cons () '(1 2 3)) '(1 2 3))
+                (equal? (sort '(3 1 2) <) '(1 2 3))))
+        'passed
+        'failed)
+    '(map filter fold sort))
+
+; equal? and member with structural hashing
+(cons
+    (if (and
+            (equal? (list 1 (list 2 3)) '(1 (2 3)))
+            (not (equal? (list 1 (list 2 3)) '(1 (2 4))))
+            (equal? (member (list 2 3) '(1 (2 3) 4)) '((2 3) 4))
+            (not (member (list 2 4) '(1 (2 3) 4))))
+        'passed
+        'failed)
+    '(equal? member))
+
+; append! and list-add!
+(cons
+    (if (letrec*
+            (b (list-builder))
+            (progn
+                (list-add! b 1)
+                (list-add! b 2)
+                (and
+                    (equal? (car b) '(1 2))
+                    (equal? (append! (list 1 2) (list 3)) '(1 2 3)))))
+        'passed
+        'failed)
+    '(append! list-add!))
+
+; bignums
+(cons
+    (if (letrec*
+            (x (* 4294967296 4294967296 4294967296))
+            (and
+                (equal? x 79228162514264337593543950336)
+                (equal? (- x x) 0)
+                (equal? (+ 18446744073709551616 1) 18446744073709551617)
+                (= (* 4294967296 4294967296) 18446744073709551616)
+                (equal? (sgn (neg x)) -1)
+                (equal? (sgn x) 1)
+                (equal? (| 9007199254740993 0) 9007199254740993)
+                (equal? (& (* 4294967296 4194304 3) 255) 0)
+                (equal? (| (<< 1 60) 1) 1152921504606846977)
+                (equal? (<< 1 96) x)
+                (equal? 100000000000000000000 1e20)
+                (equal? (sqrt 100000000000000000000) 10000000000)))
+        'passed
+        'failed)
+    '(bignums))
+
+; SIMD numeric vector primitives
+(cons
+    (if (and
+            (equal? (vadd (vector 1 2) (vector 3 4)) (vector 4 6))
+            (equal? (vsub (vector 5 7) (vector 1 2)) (vector 4 5))
+            (equal? (vmul (vector 1 2) (vector 3 4)) (vector 3 8))
+            (equal? (vdiv (vector 1 9) (vector 2 3)) (vector 0.5 3))
+            (equal? (vmap-sqrt (vector 4 9)) (vector 2 3))
+            (equal? (vdot (vector 1 2 3) (vector 4 5 6)) 32)
+            (equal? (vsum (vector 1 2 3 4 5)) 15))
+        'passed
+        'failed)
+    '(simd vectors))
+
+; call/ec escapes through catch, a stale continuation throws ERR 3
+(cons
+    (if (letrec*
+            (s ())
+            (and
+                (equal? (call/ec (lambda (k) (+ 1 (k 42)))) 42)
+                (equal? (call/ec (lambda (k) 7)) 7)
+                (equal? (call/ec (lambda (k) (catch (k 'out)))) 'out)
+                (equal? (call/ec (lambda (k) (+ 1 (call/ec (lambda (j) (k 5)))))) 5)
+                (progn (call/ec (lambda (k) (setq s k))) (equal? (catch (s 1)) '(ERR . 3)))))
+        'passed
+        'failed)
+    '(call/ec))
+
+; equal? and member on lists with a recursive closure, which is cyclic
+(cons
+    (if (letrec*
+            (f (lambda (n) (if (< n 2) n (f (- n 1)))))
+            (and
+                (equal? (list f) (list f))
+                (equal? (member (list f) (list 1 (list f) 2)) (list (list f) 2))
+                (not (equal? (list f 1) (list f 2)))))
+        'passed
+        'failed)
+    '(equal? member recursive closure))
+
+; read-each with a function that fails does not leave its file open
+(cons
+    (if (equal?
+            (catch (read-each dotcall.lisp nosuchfn))
+            '(ERR . 2))
+        'passed
+        'failed)
+    '(read-each))
+
+; map over more than 8 lists
+(cons
+    (if (equal?
+            (map + '(1 2) '(1) '(1) '(1) '(1) '(1) '(1) '(1) '(100 200))
+            '(108))
+        'passed
+        'failed)
+    '(map nine lists))
+
+; pmap copies a global future as (), touch re-raises the error of a future
+(define test-future (future 1))
+(cons
+    (if (and
+            (equal? (pmap (lambda (x) (* x x)) '(1 2 3)) '(1 4 9))
+            (equal? (touch test-future) 1)
+            (equal? (catch (touch (future (car 1)))) '(ERR . 1)))
+        'passed
+        'failed)
+    '(pmap future touch))
+
+; map applies a primitive to a new list of its arguments
+(cons
+    (if (and
+            (equal? (map atomize '(a b)) '(a b))
+            (equal? (map if '(1 ()) '(a b) '(c d)) '(a d)))
+        'passed
+        'failed)
+    '(map primitive))
+
 'OK
 (quit)